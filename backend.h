@@ -0,0 +1,46 @@
+/* Transports a headset can be reached over, picked at runtime. Every
+   backend keeps the hidapi conventions: buf[0] holds the report id, reads
+   return the size, 0 on timeout and -1 on error or at the end of a
+   replay. */
+
+#ifndef __HMD_BACKEND__
+#define __HMD_BACKEND__
+
+#include <stddef.h>
+
+#include "cache.h"
+
+typedef struct {
+	const char *name;
+	/* arrival gets the host tick the report became available */
+	int (*read)(void *dev, unsigned char *buf, size_t size,
+		    int timeout_ms, double *arrival);
+	int (*get_feature)(void *dev, unsigned char *buf, size_t size);
+	int (*send_feature)(void *dev, const unsigned char *data, size_t size);
+	void (*close)(void *dev);
+	/* a descriptor that polls readable while reports wait, for event
+	   loops; NULL where there is none */
+	int (*fd)(void *dev);
+} hmd_backend;
+
+extern const hmd_backend backend_hidapi;	// hidapi-libusb
+extern const hmd_backend backend_hidraw;	// /dev/hidrawN, no libusb
+extern const hmd_backend backend_replay;	// replay.h
+
+/* NULL if there is no backend by that name */
+const hmd_backend *backend_find(const char *name);
+
+/* Open the headset with this serial, or the first one if NULL, and copy
+   its serial to found */
+void *hidapi_open(const char *serial, char *found, size_t size);
+void *hidraw_open(const char *serial, char *found, size_t size);
+
+int hidapi_enumerate(char serials[][CACHE_SERIAL_MAX], int max);
+
+/* A pretend hidraw device on the other end of a datagram socket, for
+   testing. The peer sends the host tick it sent at as a double followed
+   by the report, and that tick is the arrival time. Feature reports read
+   back what was last written. The fd is closed with the device. */
+void *hidraw_open_fake(int fd);
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <wchar.h>
+#include <pthread.h>
+#include <hidapi.h>
+
+#include "backend.h"
+#include "log.h"
+
+#define PIMAX_VID 0x0483
+#define PIMAX_PID 0x0021
+#define MAX_STR 1024
+
+// hidapi is process wide, keep it up while any headset is open
+static pthread_mutex_t hid_users_lock = PTHREAD_MUTEX_INITIALIZER;
+static int hid_users;
+
+static int hid_acquire()
+{
+	int res = 0;
+
+	pthread_mutex_lock(&hid_users_lock);
+	if (!hid_users) {
+		res = hid_init();
+	}
+	if (!res) {
+		hid_users++;
+	}
+	pthread_mutex_unlock(&hid_users_lock);
+
+	return res;
+}
+
+static void hid_release()
+{
+	pthread_mutex_lock(&hid_users_lock);
+	if (!--hid_users) {
+		hid_exit();
+	}
+	pthread_mutex_unlock(&hid_users_lock);
+}
+
+static double get_tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+int hidapi_enumerate(char serials[][CACHE_SERIAL_MAX], int max)
+{
+	int n = 0;
+
+	if (hid_acquire()) {
+		return -1;
+	}
+
+	struct hid_device_info *devs = hid_enumerate(PIMAX_VID, PIMAX_PID);
+	for (struct hid_device_info * d = devs; d && n < max; d = d->next) {
+		size_t len = d->serial_number ?
+		    wcstombs(serials[n], d->serial_number,
+			     CACHE_SERIAL_MAX - 1) : (size_t)-1;
+		serials[n][len == (size_t)-1 ? 0 : len] = 0;
+		n++;
+	}
+	hid_free_enumeration(devs);
+
+	hid_release();
+
+	return n;
+}
+
+void *hidapi_open(const char *serial, char *found, size_t size)
+{
+	wchar_t wstr[MAX_STR];
+
+	if (hid_acquire()) {
+		LOGE("could not initialise hidapi");
+		return NULL;
+	}
+
+	if (serial && mbstowcs(wstr, serial, MAX_STR) == (size_t)-1) {
+		LOGE("invalid serial %s", serial);
+		hid_release();
+		return NULL;
+	}
+
+	hid_device *handle = hid_open(PIMAX_VID, PIMAX_PID,
+				      serial ? wstr : NULL);
+	if (!handle) {
+		LOGE("could not open device");
+		hid_release();
+		return NULL;
+	}
+
+	int res = hid_get_manufacturer_string(handle, wstr, MAX_STR);
+	LOGI("hidapi: manufacturer %ls", wstr);
+
+	res = hid_get_product_string(handle, wstr, MAX_STR);
+	LOGI("hidapi: product %ls", wstr);
+
+	res = hid_get_serial_number_string(handle, wstr, MAX_STR);
+	LOGI("hidapi: serial (%d) %ls", wstr[0], wstr);
+	size_t n = res ? (size_t)-1 : wcstombs(found, wstr, size - 1);
+	found[n == (size_t)-1 ? 0 : n] = 0;
+
+	hid_set_nonblocking(handle, 1);
+
+	return handle;
+}
+
+static int hidapi_read(void *dev, unsigned char *buf, size_t size,
+		       int timeout_ms, double *arrival)
+{
+	int res = hid_read_timeout(dev, buf, size, timeout_ms);
+	*arrival = get_tick();
+	return res;
+}
+
+static int hidapi_get_feature(void *dev, unsigned char *buf, size_t size)
+{
+	return hid_get_feature_report(dev, buf, size);
+}
+
+static int hidapi_send_feature(void *dev, const unsigned char *data,
+			       size_t size)
+{
+	return hid_send_feature_report(dev, data, size);
+}
+
+static void hidapi_close(void *dev)
+{
+	hid_close(dev);
+	hid_release();
+}
+
+const hmd_backend backend_hidapi = {
+	"hidapi", hidapi_read, hidapi_get_feature, hidapi_send_feature,
+	hidapi_close
+};
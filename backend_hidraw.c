@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/hidraw.h>
+
+#include "backend.h"
+#include "log.h"
+
+#define PIMAX_VID 0x0483
+#define PIMAX_PID 0x0021
+#define HIDRAW_NODES 64
+#define FAKE_REPORT_MAX 256
+
+typedef struct {
+	int fd;
+	int fake;
+
+	// what a fake device answers feature reads with
+	unsigned char *written[256];
+	int written_size[256];
+} hidraw_dev;
+
+static double get_tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static int read_serial(int fd, char *found, size_t size)
+{
+#ifdef HIDIOCGRAWUNIQ
+	int n = ioctl(fd, HIDIOCGRAWUNIQ(size), found);
+	if (n >= 0) {
+		found[size - 1] = 0;
+		return 0;
+	}
+#endif
+	found[0] = 0;
+	return -1;
+}
+
+void *hidraw_open(const char *serial, char *found, size_t size)
+{
+	char path[32];
+
+	for (int i = 0; i < HIDRAW_NODES; i++) {
+		struct hidraw_devinfo devinfo;
+
+		snprintf(path, sizeof(path), "/dev/hidraw%d", i);
+		int fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			continue;
+		}
+
+		if (ioctl(fd, HIDIOCGRAWINFO, &devinfo) < 0
+		    || (unsigned short)devinfo.vendor != PIMAX_VID
+		    || (unsigned short)devinfo.product != PIMAX_PID) {
+			close(fd);
+			continue;
+		}
+
+		read_serial(fd, found, size);
+		if (serial && strcmp(serial, found)) {
+			close(fd);
+			continue;
+		}
+
+		hidraw_dev *dev = calloc(1, sizeof(hidraw_dev));
+		if (!dev) {
+			close(fd);
+			return NULL;
+		}
+		dev->fd = fd;
+
+		LOGI("hidraw: opened %s, serial %s", path, found);
+		return dev;
+	}
+
+	LOGE("hidraw: could not find a headset%s%s", serial ? " with serial " :
+	     "", serial ? serial : "");
+	return NULL;
+}
+
+void *hidraw_open_fake(int fd)
+{
+	hidraw_dev *dev = calloc(1, sizeof(hidraw_dev));
+
+	if (dev) {
+		dev->fd = fd;
+		dev->fake = 1;
+	}
+
+	return dev;
+}
+
+static int hidraw_read(void *ptr, unsigned char *buf, size_t size,
+		       int timeout_ms, double *arrival)
+{
+	hidraw_dev *dev = ptr;
+	struct pollfd pfd = {.fd = dev->fd,.events = POLLIN };
+
+	// hid_read_timeout() semantics: 0 polls, -1 blocks
+	int res = poll(&pfd, 1, timeout_ms);
+	if (res <= 0) {
+		return res < 0 && errno != EINTR ? -1 : 0;
+	}
+
+	if (!dev->fake) {
+		ssize_t n = read(dev->fd, buf, size);
+		*arrival = get_tick();
+		return n;
+	}
+
+	// a fake device sends the tick it sent at, then the report
+	unsigned char msg[sizeof(double) + FAKE_REPORT_MAX];
+	ssize_t n = recv(dev->fd, msg, sizeof(msg), 0);
+	if (n < (ssize_t)sizeof(double)) {
+		return -1;	// the peer went away
+	}
+
+	int len = n - sizeof(double);
+	len = len < (int)size ? len : (int)size;
+	memcpy(arrival, msg, sizeof(double));
+	memcpy(buf, msg + sizeof(double), len);
+
+	return len;
+}
+
+static int hidraw_get_feature(void *ptr, unsigned char *buf, size_t size)
+{
+	hidraw_dev *dev = ptr;
+
+	if (!dev->fake) {
+		return ioctl(dev->fd, HIDIOCGFEATURE(size), buf);
+	}
+
+	int id = buf[0];
+	if (!dev->written[id]) {
+		return -1;
+	}
+
+	int len = dev->written_size[id] < (int)size ?
+	    dev->written_size[id] : (int)size;
+	memcpy(buf, dev->written[id], len);
+
+	return len;
+}
+
+static int hidraw_send_feature(void *ptr, const unsigned char *data,
+			       size_t size)
+{
+	hidraw_dev *dev = ptr;
+
+	if (!dev->fake) {
+		return ioctl(dev->fd, HIDIOCSFEATURE(size), data);
+	}
+
+	if (!size) {
+		return -1;
+	}
+
+	unsigned char *p = realloc(dev->written[data[0]], size);
+	if (!p) {
+		return -1;
+	}
+	memcpy(p, data, size);
+	dev->written[data[0]] = p;
+	dev->written_size[data[0]] = size;
+
+	return size;
+}
+
+static void hidraw_close(void *ptr)
+{
+	hidraw_dev *dev = ptr;
+
+	for (int i = 0; i < 256; i++) {
+		free(dev->written[i]);
+	}
+	close(dev->fd);
+	free(dev);
+}
+
+static int hidraw_fd(void *ptr)
+{
+	hidraw_dev *dev = ptr;
+
+	return dev->fd;
+}
+
+const hmd_backend backend_hidraw = {
+	"hidraw", hidraw_read, hidraw_get_feature, hidraw_send_feature,
+	hidraw_close, hidraw_fd
+};
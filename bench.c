@@ -0,0 +1,2059 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "hid.h"
+#include "decode.h"
+#include "devclock.h"
+#include "hub.h"
+#include "pimaxtrack.h"
+#include "rec.h"
+
+#define POSE_READERS 4
+#define FUSION_SAMPLES 4096
+#define CALIB_TURN_RATE 0.05f	// rad/s, a turn slow enough to look still
+#define MAGCAL_SAMPLES (300 * 1000)
+#define HISTORY_RATE 1000.0	// Hz, the tracker's sample rate
+#define DECODE_REPORTS 16384
+#define DECODE_SLOTS (DECODE_REPORTS * TRACKER_REPORT_SLOTS)
+#define REC_RECORDS (3 * REC_INDEX_INTERVAL + 100)
+#define REC_SEEKS 100000
+#define STILL_GYRO 0.03f	// rad/s, below which a report counts as still
+#define STILL_ACCEL 1.0f	// m/s^2 off gravity, likewise
+#define FW_MAX_STEP 5.0		// deg, median report to report turn of a
+				// firmware orientation that is really there
+#define MAX_TILT_P99 5.0	// deg, at rest, past which accuracy fails
+#define MAX_YAW_DRIFT 15.0	// deg/min of yaw at rest, likewise
+#define MAX_ERROR_P99 5.0	// deg off the firmware orientation, likewise
+#define MAX_ERROR_DRIFT 2.0	// deg/min the error grows by, likewise
+#define SYNTH_RATE 1000		// Hz, samples of the synthetic motion
+#define SYNTH_GYRO_BIAS 0.01f	// rad/s
+#define SYNTH_GYRO_NOISE 0.003f	// rad/s, standard deviation
+#define SYNTH_ACCEL_NOISE 0.05f	// m/s^2, likewise
+
+typedef struct {
+	const char *replay_file;
+	double seconds;
+	replay_mode mode;
+	int devices;
+	const char *backend;
+	int firmware;		// pipeline on the firmware orientation
+} bench_options;
+
+typedef struct {
+	HMDHidInfo *info;
+	atomic_int *stop;
+	pthread_t thread;
+	unsigned long long reads, torn;
+} pose_reader;
+
+static void print_stats(const char *name, const HMDHidStats * stats)
+{
+	printf("%-8s %8llu reports  latency mean %8.1f us  max %8.1f us\n",
+	       name, (unsigned long long)stats->num_reports,
+	       stats->num_reports ?
+	       stats->latency_sum / stats->num_reports * 1e6 : 0.0,
+	       stats->latency_max * 1e6);
+}
+
+/* Report arrival to decode latency of the old poll loop against the reader
+   thread, replaying a capture with its original timing. */
+static int bench_reader(const bench_options * opts)
+{
+	HMDHidInfo info;
+
+	if (HID_InitReplay(&info, opts->replay_file, REPLAY_REALTIME)) {
+		return 1;
+	}
+
+	for (int n = 0; n < opts->seconds * 1000; n++) {
+		if (HID_Read(&info) < 0) {
+			break;
+		}
+		usleep(1000);
+	}
+	print_stats("poll", &info.stats);
+	HID_Close(&info);
+
+	if (HID_InitReplay(&info, opts->replay_file, REPLAY_REALTIME)) {
+		return 1;
+	}
+
+	HID_StartReader(&info);
+	for (int n = 0; n < opts->seconds * 10 && HID_ReaderRunning(&info); n++) {
+		usleep(100000);
+	}
+	HID_StopReader(&info);
+	print_stats("thread", &info.stats);
+	HID_Close(&info);
+
+	return 0;
+}
+
+static void fill_pose(HMDPose * pose, uint32_t n)
+{
+	float v = (float)(n & 0xffff);
+
+	for (int i = 0; i < 4; i++) {
+		pose->orient.arr[i] = v;
+	}
+	for (int i = 0; i < 3; i++) {
+		pose->gyro.arr[i] = v;
+		pose->accel.arr[i] = v;
+	}
+	pose->timestamp = n;
+	pose->host_time = n;
+	pose->sample_time = n;
+}
+
+static int pose_is_consistent(const HMDPose * pose)
+{
+	HMDPose expected;
+
+	fill_pose(&expected, pose->timestamp);
+	return !memcmp(&pose->orient, &expected.orient, sizeof(quatf))
+	    && !memcmp(&pose->gyro, &expected.gyro, sizeof(vec3f))
+	    && !memcmp(&pose->accel, &expected.accel, sizeof(vec3f))
+	    && pose->host_time == expected.host_time;
+}
+
+static void *pose_reader_thread(void *arg)
+{
+	pose_reader *r = arg;
+	HMDPose pose;
+	uint32_t last = 0;
+
+	while (!atomic_load_explicit(r->stop, memory_order_relaxed)) {
+		if (HID_GetLatestPose(r->info, &pose)) {
+			continue;
+		}
+		if (!pose_is_consistent(&pose) || pose.timestamp < last) {
+			r->torn++;
+		}
+		last = pose.timestamp;
+		r->reads++;
+	}
+
+	return NULL;
+}
+
+/* Concurrent readers against a writer publishing as fast as it can; every
+   field of a published pose derives from one counter, so any torn or stale
+   snapshot shows up. */
+static int bench_pose(const bench_options * opts)
+{
+	HMDHidInfo *info = calloc(1, sizeof(HMDHidInfo));
+	pose_reader readers[POSE_READERS];
+	atomic_int stop = 0;
+	HMDPose pose;
+	uint32_t n = 1;
+
+	for (int i = 0; i < POSE_READERS; i++) {
+		readers[i] = (pose_reader) {
+		info, &stop, 0, 0, 0};
+		pthread_create(&readers[i].thread, NULL, pose_reader_thread,
+			       &readers[i]);
+	}
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (int i = 0; i < 1000; i++, n++) {
+			fill_pose(&pose, n);
+			HID_PublishPose(info, &pose);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (now.tv_sec - start.tv_sec +
+		 (now.tv_nsec - start.tv_nsec) * 1e-9 < opts->seconds);
+
+	atomic_store(&stop, 1);
+
+	unsigned long long reads = 0, torn = 0;
+	for (int i = 0; i < POSE_READERS; i++) {
+		pthread_join(readers[i].thread, NULL);
+		reads += readers[i].reads;
+		torn += readers[i].torn;
+	}
+
+	printf("pose     %u writes  %llu reads by %d readers  %llu torn\n",
+	       n - 1, reads, POSE_READERS, torn);
+	printf("         %.1f M writes/s  %.1f M reads/s\n",
+	       (n - 1) / opts->seconds * 1e-6, reads / opts->seconds * 1e-6);
+
+	free(info);
+
+	return torn ? 1 : 0;
+}
+
+static double bench_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static float noise(unsigned *seed, float scale)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return ((float)((*seed >> 8) & 0xffff) / 65535.0f - 0.5f) * scale;
+}
+
+/* Cost of one ofusion_update() on a slowly turning, noisy synthetic head */
+static int bench_fusion(const bench_options * opts)
+{
+	static vec3f gyro[FUSION_SAMPLES], accel[FUSION_SAMPLES];
+	vec3f mag = { {0.2f, -0.4f, 0.1f} };
+	unsigned seed = 1;
+	fusion f;
+
+	for (int i = 0; i < FUSION_SAMPLES; i++) {
+		gyro[i] = (vec3f) { {
+		noise(&seed, 0.02f), 0.3f + noise(&seed, 0.02f),
+			    noise(&seed, 0.02f)}};
+		accel[i] = (vec3f) { {
+		noise(&seed, 0.3f), 9.81f + noise(&seed, 0.3f),
+			    noise(&seed, 0.3f)}};
+	}
+
+	ofusion_init(&f);
+
+	unsigned long long n = 0;
+	double start = bench_now(), elapsed;
+	do {
+		for (int i = 0; i < FUSION_SAMPLES; i++) {
+			ofusion_update(&f, 0.001f, &gyro[i], &accel[i], &mag);
+		}
+		n += FUSION_SAMPLES;
+		elapsed = bench_now() - start;
+	} while (elapsed < opts->seconds);
+
+	printf("fusion   %llu samples  %.1f ns/sample  (q = %f %f %f %f)\n", n,
+	       elapsed / n * 1e9, f.orient.x, f.orient.y, f.orient.z,
+	       f.orient.w);
+
+	return 0;
+}
+
+/* Yaw drift of a still, biased gyro with the filter alone and with a
+   learned bias table, and samples until the table gets the bias right;
+   then how far the bias strays through a slow turn and into a new
+   temperature bin */
+static int bench_calib(const bench_options * opts)
+{
+	const vec3f bias = { {0.004f, -0.012f, 0.007f} };
+	int16_t temperature = 2500;
+	unsigned seed = 1;
+	gyro_calib calib;
+	fusion plain, calibrated;
+	int converged = -1;
+
+	(void)opts;
+
+	calib_init(&calib);
+	ofusion_init(&plain);
+	ofusion_init(&calibrated);
+
+	// ten seconds at 1 kHz, still the whole time
+	for (int i = 0; i < 10000; i++) {
+		vec3f gyro = { {bias.x + noise(&seed, 0.02f),
+				bias.y + noise(&seed, 0.02f),
+				bias.z + noise(&seed, 0.02f)} };
+		vec3f accel = { {noise(&seed, 0.1f),
+				 9.81f + noise(&seed, 0.1f),
+				 noise(&seed, 0.1f)} };
+		vec3f corrected;
+
+		calib_update(&calib, temperature, &gyro, &accel, &corrected);
+		ofusion_update(&plain, 0.001f, &gyro, &accel, NULL);
+		ofusion_update(&calibrated, 0.001f, &corrected, &accel, NULL);
+
+		vec3f err = { {calib.bias.x - bias.x, calib.bias.y - bias.y,
+			       calib.bias.z - bias.z} };
+		if (converged < 0 && ovec3f_get_length(&err) < 0.001f) {
+			converged = i;
+		}
+	}
+
+	// the world is Y up, so the yaw error is in the Y component
+	printf("calib    bias within 1 mrad/s after %d ms\n", converged);
+	printf("         yaw after 10 s still: filter %.2f deg  calibrated %.2f deg\n",
+	       2.0f * plain.orient.y * 57.2958f,
+	       2.0f * calibrated.orient.y * 57.2958f);
+
+	// then ten seconds of a slow, steady turn about up, which looks still
+	// but for its rate, and ten seconds still a degree warmer, in a bin
+	// of its own that starts out empty
+	float turn_err = 0, warm_err = 0;
+	for (int i = 0; i < 20000; i++) {
+		float rate = i < 10000 ? CALIB_TURN_RATE : 0;
+		vec3f gyro = { {bias.x + noise(&seed, 0.02f),
+				bias.y + rate + noise(&seed, 0.02f),
+				bias.z + noise(&seed, 0.02f)} };
+		vec3f accel = { {noise(&seed, 0.1f),
+				 9.81f + noise(&seed, 0.1f),
+				 noise(&seed, 0.1f)} };
+		vec3f corrected;
+
+		calib_update(&calib, i < 10000 ? temperature : temperature + 100,
+			     &gyro, &accel, &corrected);
+
+		vec3f err = { {calib.bias.x - bias.x, calib.bias.y - bias.y,
+			       calib.bias.z - bias.z} };
+		float *worst = i < 10000 ? &turn_err : &warm_err;
+		*worst = fmaxf(*worst, ovec3f_get_length(&err));
+	}
+	printf("         bias error at most %.2f mrad/s turning at %.1f deg/s, "
+	       "%.2f mrad/s in a new bin\n", turn_err * 1e3f,
+	       CALIB_TURN_RATE * 57.2958f, warm_err * 1e3f);
+
+	return converged < 0 || turn_err > 0.001f || warm_err > 0.002f;
+}
+
+/* A headset looking around for five minutes, its gyro biased and its field
+   shifted and squashed by its own iron: how soon the magnetometer fit is
+   good enough to use, and the orientation error with and without it */
+static int bench_magcal(const bench_options * opts)
+{
+	const vec3f bias = { {0.002f, 0.015f, -0.004f} };
+	const vec3f field = { {0.0f, -0.4f, 0.25f} };	// world, dipping
+	const vec3f hard = { {-0.25f, -0.35f, -0.6f} };
+	const float soft[3][3] = { {1.1f, 0.05f, 0}, {0.05f, 0.9f, 0},
+	{0, 0, 1.2f}
+	};
+	quatf truth = { {0, 0, 0, 1} };
+	unsigned seed = 1;
+	mag_calib magcal;
+	fusion plain, steered;
+	int usable = -1;
+	double err_plain = 0, err_steered = 0;
+
+	(void)opts;
+
+	magcal_init(&magcal);
+	ofusion_init(&plain);
+	ofusion_init(&steered);
+
+	double start = bench_now();
+	for (int i = 0; i < MAGCAL_SAMPLES; i++) {
+		float t = i * 0.001f;
+		vec3f w = { {0.8f * sinf(0.7f * t), 1.2f * sinf(0.31f * t),
+			     0.6f * cosf(0.53f * t)} };
+		quatf conj = { {-truth.x, -truth.y, -truth.z, truth.w} };
+		vec3f g = { {0, 9.81f, 0} }, accel, b, mag, corrected;
+
+		// world to sensor
+		oquatf_get_rotated(&conj, &g, &accel);
+		oquatf_get_rotated(&conj, &field, &b);
+		for (int j = 0; j < 3; j++) {
+			mag.arr[j] = hard.arr[j] + noise(&seed, 0.004f) +
+			    soft[j][0] * b.x + soft[j][1] * b.y +
+			    soft[j][2] * b.z;
+		}
+
+		vec3f gyro = { {w.x + bias.x + noise(&seed, 0.02f),
+				w.y + bias.y + noise(&seed, 0.02f),
+				w.z + bias.z + noise(&seed, 0.02f)} };
+		int have = magcal_update(&magcal, &mag, &corrected);
+		if (have && usable < 0) {
+			usable = i;
+		}
+
+		ofusion_update(&plain, 0.001f, &gyro, &accel, NULL);
+		ofusion_update(&steered, 0.001f, &gyro, &accel,
+			       have ? &corrected : NULL);
+
+		quatf d;
+		oquatf_init_axis(&d, &w, ovec3f_get_length(&w) * 0.001f);
+		quatf next;
+		oquatf_mult(&truth, &d, &next);
+		oquatf_normalize_me(&next);
+		truth = next;
+
+		if (i == MAGCAL_SAMPLES - 1) {
+			// angle between estimate and truth
+			float dp = fabsf(plain.orient.x * truth.x +
+					 plain.orient.y * truth.y +
+					 plain.orient.z * truth.z +
+					 plain.orient.w * truth.w);
+			float ds = fabsf(steered.orient.x * truth.x +
+					 steered.orient.y * truth.y +
+					 steered.orient.z * truth.z +
+					 steered.orient.w * truth.w);
+			err_plain = 2.0 * acos(fminf(dp, 1.0f)) * 57.2958;
+			err_steered = 2.0 * acos(fminf(ds, 1.0f)) * 57.2958;
+		}
+	}
+	double elapsed = bench_now() - start;
+
+	printf("magcal   usable after %d ms, quality %.2f, residual %.4f\n",
+	       usable, magcal_quality(&magcal), magcal.residual);
+	printf("         center %.3f %.3f %.3f (true %.3f %.3f %.3f)\n",
+	       magcal.center.x, magcal.center.y, magcal.center.z, hard.x,
+	       hard.y, hard.z);
+	printf("         error after 5 min: filter %.2f deg  with magnetometer %.2f deg\n",
+	       err_plain, err_steered);
+	printf("         %.1f ns/sample for both filters and the fit\n",
+	       elapsed / MAGCAL_SAMPLES * 1e9);
+
+	return usable < 0 ? 1 : 0;
+}
+
+/* A head turning at 2 rad/s while nodding, the truth for bench_history() */
+static void history_truth(double t, quatf * out)
+{
+	const vec3f up = { {0, 1, 0} }, right = { {1, 0, 0} };
+	quatf yaw, pitch;
+
+	oquatf_init_axis(&yaw, &up, (float)(2.0 * t));
+	oquatf_init_axis(&pitch, &right, (float)(0.5 * sin(3.0 * t)));
+	oquatf_mult(&yaw, &pitch, out);
+}
+
+/* Angle between two orientations in degrees, from the chord between the
+   quaternions, which keeps its precision for small angles unlike acos */
+static double orient_error(const quatf * a, const quatf * b)
+{
+	double dot = 0, chord = 0;
+
+	for (int i = 0; i < 4; i++) {
+		dot += (double)a->arr[i] * b->arr[i];
+	}
+	for (int i = 0; i < 4; i++) {
+		double d = a->arr[i] - (dot < 0 ? -b->arr[i] : b->arr[i]);
+		chord += d * d;
+	}
+
+	return 4.0 * asin(fmin(sqrt(chord) / 2, 1.0)) * 180.0 / M_PI;
+}
+
+/* Orientation error at random times between samples, interpolated against
+   taking the sample before, and the cost of a lookup */
+static int bench_history(const bench_options * opts)
+{
+	static hmd_pose_sample samples[HISTORY_SAMPLES];
+	hmd_pose_history h;
+	const vec3f zero = { {0, 0, 0} };
+	unsigned seed = 1;
+
+	history_init(&h, samples, HISTORY_SAMPLES);
+	for (int i = 0; i < HISTORY_SAMPLES; i++) {
+		quatf q;
+		history_truth(i / HISTORY_RATE, &q);
+		history_push(&h, i / HISTORY_RATE, &q, &zero);
+	}
+
+	double worst_slerp = 0, worst_before = 0;
+	for (int i = 0; i < 100000; i++) {
+		seed = seed * 1103515245 + 12345;
+		double t = (HISTORY_SAMPLES - 1) / HISTORY_RATE *
+		    ((seed >> 8) & 0xffffff) / (double)0x1000000;
+		quatf truth, before;
+		hmd_pose_sample s;
+
+		history_truth(t, &truth);
+		history_truth(floor(t * HISTORY_RATE) / HISTORY_RATE, &before);
+		if (history_at(&h, t, &s)) {
+			printf("history  no sample at %f\n", t);
+			return 1;
+		}
+		worst_slerp = fmax(worst_slerp, orient_error(&s.orient, &truth));
+		worst_before = fmax(worst_before, orient_error(&before, &truth));
+	}
+
+	unsigned long long n = 0;
+	double start = bench_now(), elapsed, sink = 0;
+	do {
+		for (int i = 0; i < 4096; i++) {
+			hmd_pose_sample s;
+			history_at(&h, i * ((HISTORY_SAMPLES - 1) / HISTORY_RATE) /
+				   4096, &s);
+			sink += s.orient.w;
+		}
+		n += 4096;
+		elapsed = bench_now() - start;
+	} while (elapsed < opts->seconds);
+
+	printf("history  max error %.5f deg slerped  %.5f deg sample before\n",
+	       worst_slerp, worst_before);
+	printf("         %.1f ns/lookup  (%g)\n", elapsed / n * 1e9, sink);
+
+	return worst_slerp < worst_before ? 0 : 1;
+}
+
+/* hid_read.ida.c as written: the mount rotation from sinf() and cosf()
+   on every report */
+static void fwquat_vendor(const unsigned char *buffer, quatf * out)
+{
+	int16_t raw[4];
+	memcpy(raw, buffer, sizeof(raw));
+
+	float v8 = raw[0] * 0.000061035156f, v9 = raw[1] * 0.000061035156f;
+	float v10 = raw[2] * 0.000061035156f, v11 = raw[3] * 0.000061035156f;
+	float v13 = sinf(0.78539819f), v14 = cosf(0.78539819f);
+	float v15 = v13 * v11 + v14 * v8 + v9 * 0.0f - v10 * 0.0f;
+	float v16 = v8 * 0.0f + v11 * 0.0f - v13 * v9 + v14 * v10;
+	float v17 = v14 * v11 - v13 * v8 - v9 * 0.0f - v10 * 0.0f;
+	float v18 = -(v11 * 0.0f - v8 * 0.0f + v14 * v9 + v13 * v10);
+	float v19 = sqrtf(v16 * v16 + v15 * v15 + v18 * v18 + v17 * v17);
+
+	if (v19 != 0.0f) {
+		v19 = 1.0f / v19;
+	}
+	// __PAIR64__(v17 * v19, v18 * v19): the low half, v18, comes first
+	*out = (quatf) { {v15 * v19, v16 * v19, v18 * v19, v17 * v19} };
+}
+
+static double fwquat_rate(void (*decode)(const unsigned char *, quatf *),
+			  const unsigned char *quats, double seconds)
+{
+	unsigned long long n = 0;
+	float sink = 0;
+	double start = bench_now(), elapsed;
+	quatf q;
+
+	do {
+		for (int i = 0; i < DECODE_REPORTS; i++) {
+			decode(quats + i * 8, &q);
+			sink += q.w;
+		}
+		n += DECODE_REPORTS;
+		elapsed = bench_now() - start;
+	} while (elapsed < seconds);
+
+	return sink == sink ? n / elapsed : 0;
+}
+
+/* Folded mount rotation and vector normalize against the vendor code */
+/* What the vendor code amounts to, from quaternion algebra rather than
+   the listing: y and z negated, then turned 90 degrees about x */
+static void fwquat_expected(const unsigned char *buffer, quatf * out)
+{
+	int16_t raw[4];
+	vec3f x_axis = { {1, 0, 0} };
+	quatf mount;
+
+	memcpy(raw, buffer, sizeof(raw));
+	quatf q = { {raw[0], -raw[1], -raw[2], raw[3]} };
+	if (!raw[0] && !raw[1] && !raw[2] && !raw[3]) {
+		q.w = 1;
+	}
+	oquatf_init_axis(&mount, &x_axis, M_PI / 2);
+	oquatf_mult(&mount, &q, out);
+	oquatf_normalize_me(out);
+}
+
+static int bench_fwquat(const bench_options * opts)
+{
+	unsigned char *quats = malloc(DECODE_REPORTS * 8);
+	unsigned seed = 1;
+	float worst = 0;
+	double worst_expected = 0;
+
+	for (int i = 0; i < DECODE_REPORTS * 8; i++) {
+		seed = seed * 1103515245 + 12345;
+		quats[i] = seed >> 16;
+	}
+
+	for (int i = 0; i < DECODE_REPORTS; i++) {
+		quatf a, b;
+		fwquat_vendor(quats + i * 8, &a);
+		decode_fw_quat(quats + i * 8, &b);
+		for (int j = 0; j < 4; j++) {
+			worst = fmaxf(worst, fabsf(a.arr[j] - b.arr[j]));
+		}
+		fwquat_expected(quats + i * 8, &a);
+		worst_expected = fmax(worst_expected, orient_error(&a, &b));
+	}
+
+	// the firmware at rest, identity, reads as 90 degrees about x, which
+	// takes y to z
+	unsigned char identity[8] = { 0, 0, 0, 0, 0, 0, 0x00, 0x40 };
+	vec3f y_axis = { {0, 1, 0} }, turned;
+	quatf id;
+	decode_fw_quat(identity, &id);
+	oquatf_get_rotated(&id, &y_axis, &turned);
+	int identity_ok = fabsf(id.x - (float)M_SQRT1_2) < 1e-6f
+	    && fabsf(id.y) < 1e-6f && fabsf(id.z) < 1e-6f
+	    && fabsf(id.w - (float)M_SQRT1_2) < 1e-6f
+	    && fabsf(turned.z - 1) < 1e-6f;
+
+	double vendor_rate = fwquat_rate(fwquat_vendor, quats,
+					 opts->seconds / 2);
+	double folded_rate = fwquat_rate(decode_fw_quat, quats,
+					 opts->seconds / 2);
+
+	printf("fwquat   max difference %g, %g deg from the algebra\n", worst,
+	       worst_expected);
+	printf("         identity -> (%.4f %.4f %.4f %.4f), y -> (%.2f %.2f "
+	       "%.2f): %s\n", id.x, id.y, id.z, id.w, turned.x, turned.y,
+	       turned.z, identity_ok ? "90 deg about x" : "WRONG");
+	printf("         vendor %.1f ns/report  folded %.1f ns/report\n",
+	       1e9 / vendor_rate, 1e9 / folded_rate);
+
+	free(quats);
+
+	return worst > 1e-6f || worst_expected > 0.01 || !identity_ok ? 1 : 0;
+}
+
+static void decode_reference(const unsigned char *reports, int count,
+			     const tracker_samples_soa * out)
+{
+	int32_t smp[3];
+	vec3f v;
+
+	for (int i = 0; i < count * TRACKER_REPORT_SLOTS; i++) {
+		const unsigned char *p = reports +
+		    (i / TRACKER_REPORT_SLOTS) * TRACKER_REPORT_SIZE +
+		    TRACKER_SAMPLE_OFFSET + (i % TRACKER_REPORT_SLOTS) * 16;
+
+		decode_sample(p, smp);
+		vec3f_from_rift_vec(smp, &v);
+		out->accel_x[i] = v.x;
+		out->accel_y[i] = v.y;
+		out->accel_z[i] = v.z;
+
+		decode_sample(p + 8, smp);
+		vec3f_from_rift_vec(smp, &v);
+		out->gyro_x[i] = v.x;
+		out->gyro_y[i] = v.y;
+		out->gyro_z[i] = v.z;
+	}
+}
+
+static tracker_samples_soa alloc_soa(int slots)
+{
+	float *f = calloc(6 * slots, sizeof(float));
+	tracker_samples_soa soa = { f, f + slots, f + 2 * slots, f + 3 * slots,
+		f + 4 * slots, f + 5 * slots
+	};
+	return soa;
+}
+
+static double decode_rate(void (*decode)(const unsigned char *, int,
+					 const tracker_samples_soa *),
+			  const unsigned char *reports, int count,
+			  const tracker_samples_soa * out, double seconds)
+{
+	unsigned long long n = 0;
+	double start = bench_now(), elapsed;
+
+	do {
+		decode(reports, count, out);
+		n += count;
+		elapsed = bench_now() - start;
+	} while (elapsed < seconds);
+
+	return n / elapsed;
+}
+
+/* Batch decoder against the per sample decoder: bit-exactness on random
+   reports and, with -r, on a capture, then reports/s of both */
+static int bench_decode(const bench_options * opts)
+{
+	unsigned char *reports = malloc(DECODE_REPORTS * TRACKER_REPORT_SIZE);
+	tracker_samples_soa ref = alloc_soa(DECODE_SLOTS);
+	tracker_samples_soa batch = alloc_soa(DECODE_SLOTS);
+	unsigned seed = 1;
+	int count = DECODE_REPORTS, mismatch = 0;
+
+	for (int i = 0; i < DECODE_REPORTS * TRACKER_REPORT_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		reports[i] = seed >> 16;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		// odd counts exercise the scalar tail
+		decode_reference(reports, count - 3, &ref);
+		decode_tracker_samples_batch(reports, count - 3, &batch);
+		if (memcmp(ref.accel_x, batch.accel_x,
+			   6 * DECODE_SLOTS * sizeof(float))) {
+			mismatch++;
+		}
+
+		if (!opts->replay_file || pass) {
+			break;
+		}
+
+		hmd_replay *replay = replay_open(opts->replay_file,
+						 REPLAY_FAST);
+		if (!replay) {
+			return 1;
+		}
+		for (count = 0; count < DECODE_REPORTS;) {
+			unsigned char *r = reports + count * TRACKER_REPORT_SIZE;
+			int size = replay_read(replay, r, TRACKER_REPORT_SIZE, 0);
+			if (size < 0) {
+				break;
+			}
+			if (size == TRACKER_REPORT_SIZE
+			    && r[0] == RIFT_IRQ_SENSORS_DK2) {
+				count++;
+			}
+		}
+		replay_close(replay);
+	}
+
+	double ref_rate = decode_rate(decode_reference, reports, count, &ref,
+				      opts->seconds / 2);
+	double batch_rate = decode_rate(decode_tracker_samples_batch, reports,
+					count, &batch, opts->seconds / 2);
+
+	printf("decode   %s  %s\n", decode_batch_impl(),
+	       mismatch ? "MISMATCH" : "bit-exact");
+	printf("         scalar %.1f M reports/s  batch %.1f M reports/s\n",
+	       ref_rate * 1e-6, batch_rate * 1e-6);
+
+	free(reports);
+	free(ref.accel_x);
+	free(batch.accel_x);
+
+	return mismatch ? 1 : 0;
+}
+
+static const char *stage_names[HID_STAGE_COUNT] = {
+	"read", "decode", "fuse", "publish", "total", "interval", "jitter"
+};
+
+typedef struct {
+	int fd;
+	atomic_int stop;
+	pthread_t thread;
+} fake_device;
+
+/* DK2 sensor reports every 2 ms, two samples each, stamped with the tick
+   they were sent at for the fake hidraw backend */
+static void *fake_device_thread(void *arg)
+{
+	fake_device *fake = arg;
+	unsigned char msg[sizeof(double) + TRACKER_REPORT_SIZE] = { 0 };
+	unsigned char *report = msg + sizeof(double);
+	uint32_t timestamp = 0;
+	double next = bench_now();
+	struct timespec ts;
+
+	report[0] = 11;
+	report[3] = 2;
+
+	while (!atomic_load(&fake->stop)) {
+		next += 0.002;
+		ts.tv_sec = (time_t)next;
+		ts.tv_nsec = (long)((next - (double)ts.tv_sec) * 1e9);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL)) ;
+
+		timestamp += 2000;
+		for (int i = 0; i < 4; i++) {
+			report[8 + i] = timestamp >> (8 * i);
+		}
+
+		double now = bench_now();
+		memcpy(msg, &now, sizeof(now));
+		if (send(fake->fd, msg, sizeof(msg), MSG_NOSIGNAL) < 0) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int fake_device_start(fake_device * fake, HMDHidInfo * info)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+		perror("socketpair");
+		return -1;
+	}
+
+	fake->fd = fds[1];
+	atomic_store(&fake->stop, 0);
+	if (HID_InitBackend(info, &backend_hidraw, hidraw_open_fake(fds[0]))
+	    || pthread_create(&fake->thread, NULL, fake_device_thread, fake)) {
+		close(fds[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fake_device_stop(fake_device * fake)
+{
+	atomic_store(&fake->stop, 1);
+	pthread_join(fake->thread, NULL);
+	close(fake->fd);
+}
+
+/* Replay a capture or recording through the reader thread with profiling
+   on and print where each report's time went. With -f the capture is fed
+   as fast as it decodes, which leaves only the processing stages. With -b
+   instead of -r the reports come from a headset over that backend, or from
+   a fake hidraw device on a socket for -b fake. */
+static int bench_pipeline(const bench_options * opts)
+{
+	HMDHidInfo info;
+	fake_device fake;
+	int is_fake = !opts->replay_file && !strcmp(opts->backend, "fake");
+	int res;
+
+	if (opts->replay_file) {
+		res = HID_InitReplay(&info, opts->replay_file, opts->mode);
+	} else if (is_fake) {
+		res = fake_device_start(&fake, &info);
+	} else {
+		res = HID_InitDevice(&info, opts->backend, NULL);
+	}
+	if (res || HID_EnableProfile(&info)) {
+		return 1;
+	}
+	if (opts->firmware) {
+		info.orient_source = HID_ORIENT_FIRMWARE;
+	}
+
+	double start = bench_now();
+	HID_StartReader(&info);
+	while (HID_ReaderRunning(&info) && bench_now() - start < opts->seconds) {
+		usleep(10000);
+	}
+	HID_StopReader(&info);
+	double elapsed = bench_now() - start;
+	if (is_fake) {
+		fake_device_stop(&fake);
+	}
+
+	printf("%llu reports in %.2f s (%.0f/s)\n",
+	       (unsigned long long)info.stats.num_reports, elapsed,
+	       info.stats.num_reports / elapsed);
+	printf("%-10s %10s %10s %10s %10s %10s\n", "stage (us)", "count",
+	       "p50", "p99", "p99.9", "max");
+	for (int i = 0; i < HID_STAGE_COUNT; i++) {
+		const hmd_histogram *h = &info.profile->stage[i];
+		printf("%-10s %10llu %10.2f %10.2f %10.2f %10.2f\n",
+		       stage_names[i], (unsigned long long)h->count,
+		       hist_percentile(h, 0.5) * 1e6,
+		       hist_percentile(h, 0.99) * 1e6,
+		       hist_percentile(h, 0.999) * 1e6, hist_max(h) * 1e6);
+	}
+
+	HMDHidHealth total;
+	if (!HID_GetHealth(&info, NULL, &total)) {
+		printf("health over %.1f s: %llu samples, %llu dropped in %llu "
+		       "gaps, %llu repeated, %llu timeouts, %llu bad reports, "
+		       "interval mean %.2f ms max %.2f ms\n", total.length,
+		       (unsigned long long)total.samples,
+		       (unsigned long long)total.dropped,
+		       (unsigned long long)total.gaps,
+		       (unsigned long long)total.repeated,
+		       (unsigned long long)total.timeouts,
+		       (unsigned long long)total.decode_errors,
+		       total.reports ?
+		       total.interval_sum / total.reports * 1e3 : 0.0,
+		       total.interval_max * 1e3);
+	}
+
+	HID_Close(&info);
+
+	return 0;
+}
+
+static void *hog_thread(void *arg)
+{
+	atomic_int *stop = arg;
+	volatile unsigned long spins = 0;
+
+	while (!atomic_load_explicit(stop, memory_order_relaxed)) {
+		spins++;
+	}
+
+	return NULL;
+}
+
+/* How late the reader sees reports of a real-time replay while a busy
+   thread per core competes for the CPU, without and with the real-time
+   mode pinning it to the last core */
+static int bench_rt(const bench_options * opts)
+{
+	int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *hogs = calloc(cores, sizeof(pthread_t));
+	atomic_int stop = 0;
+	int res = 0;
+
+	for (int i = 0; i < cores; i++) {
+		pthread_create(&hogs[i], NULL, hog_thread, &stop);
+	}
+
+	printf("report available to read, us, %d busy threads\n", cores);
+	printf("%-10s %10s %10s %10s %10s\n", "mode", "p50", "p99", "p99.9",
+	       "max");
+	for (int rt = 0; rt < 2 && !res; rt++) {
+		HMDHidInfo info;
+
+		if (HID_InitReplay(&info, opts->replay_file, REPLAY_REALTIME)
+		    || HID_EnableProfile(&info)) {
+			res = 1;
+			break;
+		}
+		if (rt && HID_SetRealtime(&info, cores - 1, HID_RT_PRIORITY)) {
+			HID_Close(&info);
+			res = 1;
+			break;
+		}
+
+		double start = bench_now();
+		HID_StartReader(&info);
+		while (HID_ReaderRunning(&info)
+		       && bench_now() - start < opts->seconds / 2) {
+			usleep(10000);
+		}
+		HID_StopReader(&info);
+
+		const hmd_histogram *h = &info.profile->stage[HID_STAGE_READ];
+		printf("%-10s %10.2f %10.2f %10.2f %10.2f", rt ? "real-time" :
+		       "normal", hist_percentile(h, 0.5) * 1e6,
+		       hist_percentile(h, 0.99) * 1e6,
+		       hist_percentile(h, 0.999) * 1e6, hist_max(h) * 1e6);
+		if (rt) {
+			printf("  (%s, %s, %s)", info.realtime.pinned ?
+			       "pinned" : "not pinned", info.realtime.fifo ?
+			       "SCHED_FIFO" : "not SCHED_FIFO",
+			       info.realtime.locked ? "locked" : "not locked");
+		}
+		printf("\n");
+
+		HID_Close(&info);
+	}
+
+	atomic_store(&stop, 1);
+	for (int i = 0; i < cores; i++) {
+		pthread_join(hogs[i], NULL);
+	}
+	free(hogs);
+
+	return res;
+}
+
+typedef struct {
+	atomic_ulong samples, poses;
+} lib_counts;
+
+static void lib_sample(void *user, const pimaxtrack_sample * sample)
+{
+	lib_counts *c = user;
+	atomic_fetch_add_explicit(&c->samples, 1, memory_order_relaxed);
+}
+
+static void lib_pose(void *user, const pimaxtrack_pose * pose)
+{
+	lib_counts *c = user;
+	atomic_fetch_add_explicit(&c->poses, 1, memory_order_relaxed);
+}
+
+/* The capture through the library API: -n trackers side by side, each
+   with callbacks and a consumer draining its pose queue, then open, start
+   and close cycles for the shutdown path */
+static int bench_lib(const bench_options * opts)
+{
+	int n = opts->devices;
+	pimaxtrack **t = calloc(n, sizeof(pimaxtrack *));
+	lib_counts *counts = calloc(n, sizeof(lib_counts));
+	unsigned long long *drained = calloc(n, sizeof(unsigned long long));
+	uint64_t *cursors = calloc(n, sizeof(uint64_t));
+	pimaxtrack_pose poses[64];
+	int res = 0;
+
+	for (int i = 0; i < n; i++) {
+		pimaxtrack_callbacks cb = { lib_sample, lib_pose, &counts[i] };
+		t[i] = pimaxtrack_open_replay(opts->replay_file,
+					      opts->mode == REPLAY_FAST);
+		if (!t[i] || pimaxtrack_start(t[i], &cb)) {
+			res = 1;
+		}
+	}
+
+	double start = bench_now();
+	int running = !res;
+	while (running && bench_now() - start < opts->seconds) {
+		running = 0;
+		for (int i = 0; i < n; i++) {
+			int got;
+			while ((got = pimaxtrack_read_poses(t[i], &cursors[i],
+							    poses, 64))) {
+				drained[i] += got;
+			}
+			running |= pimaxtrack_running(t[i]);
+		}
+		usleep(1000);
+	}
+
+	for (int i = 0; i < n; i++) {
+		pimaxtrack_close(t[i]);
+		if (!res) {
+			printf("tracker %d  %lu samples and %lu poses by callback, "
+			       "%llu queued poses drained\n", i,
+			       atomic_load(&counts[i].samples),
+			       atomic_load(&counts[i].poses), drained[i]);
+		}
+	}
+
+	double cycle = bench_now();
+	int cycles = 0;
+	for (; cycles < 20 && !res; cycles++) {
+		pimaxtrack *c = pimaxtrack_open_replay(opts->replay_file, 0);
+		if (!c || pimaxtrack_start(c, NULL)) {
+			pimaxtrack_close(c);
+			res = 1;
+		}
+		pimaxtrack_close(c);
+	}
+	if (!res) {
+		printf("open, start and close: %.1f ms a cycle over %d\n",
+		       (bench_now() - cycle) / cycles * 1e3, cycles);
+	}
+
+	free(t);
+	free(counts);
+	free(drained);
+	free(cursors);
+
+	return res;
+}
+
+/* Fit the device clock of a capture replayed in real time and show how far
+   report arrivals scatter around the fitted line */
+static int bench_clock(const bench_options * opts)
+{
+	hmd_replay *replay = replay_open(opts->replay_file, REPLAY_REALTIME);
+	hmd_devclock clock;
+	hmd_histogram residual = { 0 };
+	unsigned char buf[TRACKER_REPORT_SIZE];
+	double start = bench_now();
+
+	if (!replay) {
+		return 1;
+	}
+
+	devclock_init(&clock, 0.001);
+
+	while (bench_now() - start < opts->seconds) {
+		int size = replay_read(replay, buf, sizeof(buf), -1);
+		if (size < 0) {
+			break;
+		}
+		if (size < TRACKER_REPORT_SIZE || buf[0] != 11) {
+			continue;
+		}
+
+		uint32_t raw = buf[8] | (buf[9] << 8) | (buf[10] << 16) |
+		    ((uint32_t)buf[11] << 24);
+		double arrival = replay_report_time(replay);
+		uint64_t now = devclock_update(&clock, raw, DEVCLOCK_WRAP_DK2,
+					       buf[3], arrival);
+
+		if (clock.fitted) {
+			// arrivals lag the line as often as they lead it
+			double r = arrival - devclock_host_time(&clock, now);
+			hist_record(&residual, r < 0 ? -r : r);
+		}
+	}
+
+	printf("sample rate %.3f Hz, drift %+.1f ppm, %llu clock resets\n",
+	       1.0 / clock.period, devclock_drift_ppm(&clock),
+	       (unsigned long long)clock.resets);
+	printf("|arrival - fit| over %llu reports: p50 %.1f us  p99 %.1f us"
+	       "  max %.1f us\n", (unsigned long long)residual.count,
+	       hist_percentile(&residual, 0.5) * 1e6,
+	       hist_percentile(&residual, 0.99) * 1e6,
+	       hist_max(&residual) * 1e6);
+
+	replay_close(replay);
+
+	return 0;
+}
+
+/* Point the per-device cache at a new empty directory, for runs that must
+   not depend on what earlier ones learnt */
+static int scratch_cache(char *dir)
+{
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return -1;
+	}
+	setenv("XDG_CACHE_HOME", dir, 1);
+
+	return 0;
+}
+
+static void drop_scratch_cache(const char *dir, const char *serial)
+{
+	static const char *kinds[] = { "config", "gyro", "mag" };
+	char path[256];
+
+	for (int i = 0; i < (int)(sizeof(kinds) / sizeof(kinds[0])); i++) {
+		snprintf(path, sizeof(path), "%s/%s/%s.%s", dir, CACHE_DIR,
+			 serial, kinds[i]);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/%s", dir, CACHE_DIR);
+	rmdir(path);
+	rmdir(dir);
+}
+
+typedef struct {
+	HMDPose *poses;
+	size_t count, size;
+	double time;		// device time of the last, in s
+	double *times;
+} pose_log;
+
+/* Keep every pose with its device time, the 32 bit timestamp unwrapped */
+static void log_pose(void *user, const HMDPose * pose)
+{
+	pose_log *log = user;
+
+	if (log->count == log->size) {
+		log->size = log->size ? log->size * 2 : 4096;
+		log->poses = realloc(log->poses, log->size * sizeof(HMDPose));
+		log->times = realloc(log->times, log->size * sizeof(double));
+	}
+	if (log->count) {
+		uint32_t last = log->poses[log->count - 1].timestamp;
+		log->time += (int32_t)(pose->timestamp - last) * 1e-6;
+	}
+	log->poses[log->count] = *pose;
+	log->times[log->count++] = log->time;
+}
+
+/* Replay the whole capture into log from an empty cache, so no calibration
+   an earlier run learnt carries over. Returns the samples it took in, or
+   -1 on error; *cpu is the process CPU time spent. */
+static long long replay_poses(const char *path, HMDOrientSource source,
+			      pose_log * log, double *cpu)
+{
+	char dir[] = "/tmp/pimax-bench-XXXXXX";
+	HMDCallbacks callbacks = { NULL, log_pose, log };
+	HMDHidInfo info;
+	HMDHidHealth total;
+	struct timespec a, b;
+
+	if (scratch_cache(dir)) {
+		return -1;
+	}
+	if (HID_InitReplay(&info, path, REPLAY_FAST)) {
+		drop_scratch_cache(dir, "");
+		return -1;
+	}
+	info.orient_source = source;
+	HID_SetCallbacks(&info, &callbacks);
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &a);
+	HID_StartReader(&info);
+	while (HID_ReaderRunning(&info)) {
+		usleep(1000);
+	}
+	HID_StopReader(&info);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &b);
+	*cpu = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) * 1e-9;
+
+	long long samples = -1;
+	if (!HID_GetHealth(&info, NULL, &total)) {
+		samples = source == HID_ORIENT_FIRMWARE ?
+		    (long long)total.reports : (long long)total.samples;
+	}
+	// closing stores what calibration learnt, so drop the cache after
+	char serial[CACHE_SERIAL_MAX];
+	strcpy(serial, info.serial);
+	HID_Close(&info);
+	drop_scratch_cache(dir, serial);
+
+	return samples;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double *v, size_t n, double p)
+{
+	qsort(v, n, sizeof(double), cmp_double);
+
+	return n ? v[(size_t)(p * (n - 1))] : 0.0;
+}
+
+/* Reports without the firmware orientation are fused even on that source,
+   and only those poses have sensor readings */
+static int pose_from_firmware(const HMDPose * pose)
+{
+	static const vec3f zero;
+
+	return !memcmp(&pose->gyro, &zero, sizeof(zero))
+	    && !memcmp(&pose->accel, &zero, sizeof(zero));
+}
+
+static int pose_still(const HMDPose * pose)
+{
+	return ovec3f_get_length(&pose->gyro) < STILL_GYRO
+	    && fabsf(ovec3f_get_length(&pose->accel) - 9.81f) < STILL_ACCEL;
+}
+
+/* Angle between gravity as the accelerometer saw it, turned into the world
+   by orient, and world up */
+static double tilt_error(const quatf * orient, const vec3f * accel)
+{
+	vec3f up;
+
+	oquatf_get_rotated(orient, accel, &up);
+	float len = ovec3f_get_length(&up);
+
+	return acos(fmax(-1.0, fmin(1.0, up.y / len))) * 180.0 / M_PI;
+}
+
+static double heading(const quatf * orient)
+{
+	vec3f forward = { {0, 0, -1} }, out;
+
+	oquatf_get_rotated(orient, &forward, &out);
+
+	return atan2(out.x, -out.z) * 180.0 / M_PI;
+}
+
+/* Report a figure past its limit; returns 1 if it is */
+static int over_limit(const char *name, const char *what, double value,
+		      double limit)
+{
+	if (!(value > limit)) {
+		return 0;
+	}
+	fprintf(stderr, "%s %s %.3f over the %.3f limit\n", name, what, value,
+		limit);
+
+	return 1;
+}
+
+/* Against truth it has none of, how a source holds up while the headset
+   rests: the tilt error against the accelerometer, and the yaw it turns
+   through per minute of rest, taken from the fused pass's sensors. Returns
+   how many of those are over their limits */
+static int still_figures(const char *name, const pose_log * log,
+			  const pose_log * sensors, const size_t *match,
+			  double cpu, long long samples)
+{
+	double *tilt = malloc(log->count * sizeof(double));
+	double yaw = 0, still_time = 0, span_start = 0, start_heading = 0;
+	size_t n = 0;
+	int in_span = 0;
+
+	for (size_t i = 0; i <= log->count; i++) {
+		const HMDPose *s = i < log->count && match[i] != (size_t)-1 ?
+		    &sensors->poses[match[i]] : NULL;
+		int still = s && pose_still(s);
+
+		if (still) {
+			tilt[n++] = tilt_error(&log->poses[i].orient, &s->accel);
+		}
+		if (still && !in_span) {
+			span_start = log->times[i];
+			start_heading = heading(&log->poses[i].orient);
+		} else if (!still && in_span) {
+			double d = heading(&log->poses[i - 1].orient) -
+			    start_heading;
+			yaw += fabs(remainder(d, 360.0));
+			still_time += log->times[i - 1] - span_start;
+		}
+		in_span = still;
+	}
+
+	double mean = 0;
+	for (size_t i = 0; i < n; i++) {
+		mean += tilt[i];
+	}
+	double p99 = percentile(tilt, n, 0.99);
+	double drift = still_time > 0 ? yaw / still_time * 60.0 : 0.0;
+	printf("%-8s %8zu still %6.1f s  tilt mean %6.3f p99 %6.3f deg  "
+	       "yaw drift %7.3f deg/min  %6.3f us/sample\n", name, n,
+	       still_time, n ? mean / n : 0.0, p99, drift,
+	       samples > 0 ? cpu / samples * 1e6 : 0.0);
+
+	free(tilt);
+
+	return over_limit(name, "tilt p99 deg", p99, MAX_TILT_P99) +
+	    over_limit(name, "yaw drift deg/min", drift, MAX_YAW_DRIFT);
+}
+
+/* Replay fused_path through the host filter and fw_path on the firmware
+   orientation, and score the filter against it: the angular error once
+   the fixed offset between the two is taken out, how fast that error
+   grows per minute, and the CPU time either takes per sample. Both get
+   tilt and resting yaw drift figures against the accelerometer, which is
+   all a trace without the firmware's one has. Fails when any figure is
+   past its MAX_ limit, or with need_fw when there was nothing to score
+   the filter against. */
+static int accuracy(const char *fused_path, const char *fw_path, int need_fw)
+{
+	pose_log fused = { 0 }, fw = { 0 };
+	double fused_cpu, fw_cpu;
+	long long fused_samples = replay_poses(fused_path, HID_ORIENT_FUSION,
+					       &fused, &fused_cpu);
+	long long fw_samples = replay_poses(fw_path, HID_ORIENT_FIRMWARE,
+					    &fw, &fw_cpu);
+	int res = 1, over = 0;
+
+	if (fused_samples < 0 || fw_samples < 0 || !fused.count || !fw.count) {
+		fprintf(stderr, "no poses from %s\n", fused.count ? fw_path :
+			fused_path);
+		goto out;
+	}
+
+	// the same report in either pass, by device time
+	size_t *match = malloc(fw.count * sizeof(size_t));
+	size_t *self = malloc(fused.count * sizeof(size_t));
+	size_t paired = 0;
+	double base = (int32_t)(fw.poses[0].timestamp -
+				fused.poses[0].timestamp) * 1e-6;
+	for (size_t i = 0, j = 0; i < fw.count; i++) {
+		while (j < fused.count && fused.times[j] < fw.times[i] + base
+		       - 1e-7) {
+			j++;
+		}
+		match[i] = j < fused.count && fused.poses[j].timestamp ==
+		    fw.poses[i].timestamp ? j : (size_t)-1;
+		paired += match[i] != (size_t)-1;
+	}
+	for (size_t j = 0; j < fused.count; j++) {
+		self[j] = j;
+	}
+
+	size_t from_fw = 0;
+	for (size_t i = 0; i < fw.count; i++) {
+		if (pose_from_firmware(&fw.poses[i])) {
+			from_fw++;
+		} else {
+			match[i] = (size_t)-1;
+		}
+	}
+
+	printf("%zu fused poses, %zu firmware poses, %zu paired\n",
+	       fused.count, from_fw, paired);
+	over += still_figures("fusion", &fused, &fused, self, fused_cpu,
+			      fused_samples);
+
+	double *err = malloc(fw.count * sizeof(double));
+	size_t n = 0;
+	if (!from_fw) {
+		printf("firmware no report carries its orientation, no error "
+		       "against it\n");
+		res = over > 0 || need_fw;
+		goto done;
+	}
+
+	// a quaternion read from the wrong place jumps about
+	for (size_t i = 1; i < fw.count; i++) {
+		if (pose_from_firmware(&fw.poses[i - 1])
+		    && pose_from_firmware(&fw.poses[i])) {
+			err[n++] = orient_error(&fw.poses[i - 1].orient,
+						&fw.poses[i].orient);
+		}
+	}
+	double step = percentile(err, n, 0.5);
+	if (step > FW_MAX_STEP) {
+		printf("firmware %6.3f us/sample, but its orientation turns a "
+		       "median %.1f deg per report: the trace carries none, no "
+		       "error against it\n", fw_samples > 0 ?
+		       fw_cpu / fw_samples * 1e6 : 0.0, step);
+		res = over > 0 || need_fw;
+		goto done;
+	}
+	over += still_figures("firmware", &fw, &fused, match, fw_cpu,
+			      fw_samples);
+
+	// the filter and the firmware agree on up but not on heading; take the
+	// offset between them at the first resting report after a second
+	quatf offset = { {0, 0, 0, 1} };
+	for (size_t i = 0; i < fw.count; i++) {
+		if (match[i] != (size_t)-1 && fw.times[i] - fw.times[0] > 1.0
+		    && pose_still(&fused.poses[match[i]])) {
+			const quatf *f = &fw.poses[i].orient;
+			quatf inv = { {-f->x, -f->y, -f->z, f->w} };
+			oquatf_mult(&fused.poses[match[i]].orient, &inv, &offset);
+			break;
+		}
+	}
+
+	// least squares line through the error over device time
+	double st = 0, se = 0, stt = 0, ste = 0, max = 0;
+	n = 0;
+	for (size_t i = 0; i < fw.count; i++) {
+		if (match[i] == (size_t)-1) {
+			continue;
+		}
+		quatf q;
+		oquatf_mult(&offset, &fw.poses[i].orient, &q);
+		double e = orient_error(&fused.poses[match[i]].orient, &q);
+		double t = fw.times[i] - fw.times[0];
+		st += t;
+		se += e;
+		stt += t * t;
+		ste += t * e;
+		max = fmax(max, e);
+		err[n++] = e;
+	}
+	double d = n * stt - st * st;
+	double slope = d > 0 ? (n * ste - st * se) / d : 0.0;
+	double p99 = percentile(err, n, 0.99);
+	printf("error    p50 %.3f p99 %.3f max %.3f deg, drift %.3f deg/min\n",
+	       percentile(err, n, 0.5), p99, max, slope * 60.0);
+	over += over_limit("error", "p99 deg", p99, MAX_ERROR_P99);
+	over += over_limit("error", "drift deg/min", fabs(slope * 60.0),
+			   MAX_ERROR_DRIFT);
+	res = over > 0;
+
+ done:
+	free(err);
+	free(match);
+	free(self);
+ out:
+	free(fused.poses);
+	free(fused.times);
+	free(fw.poses);
+	free(fw.times);
+
+	return res;
+}
+
+static float gaussian(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (double)rand() / RAND_MAX;
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* Three 21 bit values packed big endian into 8 bytes, the reverse of
+   decode_sample(), in the 1e-4 units of the reports */
+static void put_sample(unsigned char *p, const vec3f * v)
+{
+	uint64_t w = 0;
+
+	for (int i = 0; i < 3; i++) {
+		int32_t s = lrintf(v->arr[i] * 1e4f);
+		w |= (uint64_t)(s & 0x1fffff) << (43 - 21 * i);
+	}
+	for (int i = 0; i < 8; i++) {
+		p[i] = w >> (56 - 8 * i);
+	}
+}
+
+/* The raw quaternion decode_fw_quat() turns into q */
+static void put_fw_quat(unsigned char *p, const quatf * q)
+{
+	float raw[4] = { (q->x - q->w) / 2, -(q->y + q->z) / 2,
+		(q->y - q->z) / 2, (q->x + q->w) / 2
+	};
+
+	for (int i = 0; i < 4; i++) {
+		PKT_S16_STORE(p + 2 * i, lrintf(raw[i] * 16384));
+	}
+}
+
+/* Turns at body rates in rad/s, with rests between for the bias */
+static const struct {
+	double seconds;
+	vec3f rate;
+} synth_motion[] = {
+	{ 10, { {0, 0, 0} } },
+	{ 3, { {0, 0.5f, 0} } },
+	{ 5, { {0, 0, 0} } },
+	{ 2, { {0.4f, 0, 0} } },
+	{ 5, { {0, 0, 0} } },
+	{ 2, { {-0.4f, 0, 0} } },
+	{ 2, { {0, 0, 0.3f} } },
+	{ 5, { {0, 0, 0} } },
+	{ 2, { {0, 0, -0.3f} } },
+	{ 3, { {0, -0.5f, 0} } },
+	{ 10, { {0, 0, 0} } },
+};
+
+/* Write synth_motion as two recordings of the same DK2 reports, 2 samples
+   each: fused_path with the samples a biased, noisy IMU would give, and
+   fw_path with the true orientation in the 32 byte firmware reports */
+static int synth_recordings(const char *fused_path, const char *fw_path)
+{
+	uint64_t samples = 0;
+	for (int i = 0; i < (int)(sizeof(synth_motion) /
+				  sizeof(synth_motion[0])); i++) {
+		samples += synth_motion[i].seconds * SYNTH_RATE;
+	}
+
+	hmd_rec *fused = rec_create(fused_path, samples / 2);
+	hmd_rec *fw = rec_create(fw_path, samples / 2);
+	if (!fused || !fw) {
+		if (fused) {
+			rec_close(fused);
+		}
+		return -1;
+	}
+
+	const vec3f gravity = { {0, 9.81f, 0} };
+	const vec3f bias = { {SYNTH_GYRO_BIAS, -SYNTH_GYRO_BIAS, 0} };
+	quatf q = { {0, 0, 0, 1} };
+	unsigned char report[PKT_TRACKER_DK2_SIZE] = { RIFT_IRQ_SENSORS_DK2 };
+	unsigned char fw_report[PKT_FW_QUAT_REPORT_SIZE] =
+	    { RIFT_IRQ_SENSORS_DK2 };
+	uint64_t n = 0;
+
+	srand(1);
+	report[3] = 2;
+	PKT_S16_STORE(report + 6, 2500);	// 25 C
+	for (int i = 0; i < (int)(sizeof(synth_motion) /
+				  sizeof(synth_motion[0])); i++) {
+		const vec3f *rate = &synth_motion[i].rate;
+		float speed = ovec3f_get_length(rate);
+		quatf step = { {0, 0, 0, 1} };
+		if (speed > 0) {
+			vec3f axis = { {rate->x / speed, rate->y / speed,
+					rate->z / speed} };
+			oquatf_init_axis(&step, &axis, speed / SYNTH_RATE);
+		}
+
+		for (uint64_t end = n + synth_motion[i].seconds * SYNTH_RATE;
+		     n < end; n++) {
+			quatf next, inv;
+			vec3f accel, gyro;
+
+			oquatf_mult(&q, &step, &next);
+			q = next;
+			inv = (quatf) { {-q.x, -q.y, -q.z, q.w} };
+			oquatf_get_rotated(&inv, &gravity, &accel);
+			for (int k = 0; k < 3; k++) {
+				accel.arr[k] += gaussian() * SYNTH_ACCEL_NOISE;
+				gyro.arr[k] = rate->arr[k] + bias.arr[k] +
+				    gaussian() * SYNTH_GYRO_NOISE;
+			}
+
+			unsigned char *slot = report + 12 + 16 * (n % 2);
+			put_sample(slot, &accel);
+			put_sample(slot + 8, &gyro);
+			if (n % 2 == 0) {
+				continue;
+			}
+
+			// stamped with the last sample, in us from 1 s on
+			double t = (double)n / SYNTH_RATE;
+			uint32_t timestamp = 1000000 + n * (1000000 / SYNTH_RATE);
+			PKT_U16_STORE(report + 4, n + 1);
+			PKT_U32_STORE(report + 8, timestamp);
+			PKT_U32_STORE(fw_report + 8, timestamp);
+			put_fw_quat(fw_report + PKT_FW_QUAT_OFFSET, &q);
+			rec_write(fused, report, sizeof(report), 1.0 + t);
+			rec_write(fw, fw_report, sizeof(fw_report), 1.0 + t);
+		}
+	}
+
+	rec_close(fused);
+	rec_close(fw);
+
+	return 0;
+}
+
+/* accuracy() on a capture, or without one on synth_motion, where the
+   firmware orientation is the truth and must be there to score against */
+static int bench_accuracy(const bench_options * opts)
+{
+	if (opts->replay_file) {
+		return accuracy(opts->replay_file, opts->replay_file, 0);
+	}
+
+	char fused[] = "/tmp/pimax-bench-XXXXXX";
+	char fw[] = "/tmp/pimax-bench-XXXXXX";
+	int fused_fd = mkstemp(fused), fw_fd = mkstemp(fw);
+	int res = 1;
+
+	if (fused_fd < 0 || fw_fd < 0) {
+		perror("mkstemp");
+	} else if (!synth_recordings(fused, fw)) {
+		res = accuracy(fused, fw, 1);
+	}
+	if (fused_fd >= 0) {
+		close(fused_fd);
+		unlink(fused);
+	}
+	if (fw_fd >= 0) {
+		close(fw_fd);
+		unlink(fw);
+	}
+
+	return res;
+}
+
+/* Start from a capture twice in a scratch cache directory, once with no
+   cached config and once with the config the first run left behind */
+static int bench_init(const bench_options * opts)
+{
+	char dir[] = "/tmp/pimax-bench-XXXXXX";
+	char serial[CACHE_SERIAL_MAX] = "";
+	HMDHidInfo info;
+
+	if (scratch_cache(dir)) {
+		return 1;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		if (HID_InitReplay(&info, opts->replay_file, REPLAY_FAST)) {
+			return 1;
+		}
+		while (!info.stats.num_reports && HID_Read(&info) >= 0) ;
+		printf("%-6s %-13s %2d feature reports, first sample after "
+		       "%.1f us\n", pass ? "warm" : "cold",
+		       info.stats.fast_init ? "cached config" : "full sequence",
+		       atomic_load(&info.stats.feature_reports),
+		       info.stats.first_sample * 1e6);
+
+		strcpy(serial, info.serial);
+		HID_Close(&info);
+	}
+
+	drop_scratch_cache(dir, serial);
+
+	return 0;
+}
+
+/* Several devices replaying the same capture through one hub, to see
+   whether each keeps its latency as devices are added */
+static int bench_hub(const bench_options * opts)
+{
+	const char *paths[HUB_MAX_DEVICES];
+	fake_device fakes[HUB_MAX_DEVICES];
+	int num_fakes = 0, threads = 0;
+	struct timespec cpu;
+	uint64_t total = 0;
+	hmd_hub *hub;
+
+	if (opts->devices < 1 || opts->devices > HUB_MAX_DEVICES) {
+		fprintf(stderr, "1 to %d devices\n", HUB_MAX_DEVICES);
+		return 1;
+	}
+
+	if (opts->replay_file) {
+		for (int i = 0; i < opts->devices; i++) {
+			paths[i] = opts->replay_file;
+		}
+		hub = hub_open_replays(paths, opts->devices, opts->mode,
+				       HID_KEEP_ALIVE_MARGIN);
+	} else if ((hub = hub_create())) {
+		// fake hidraw devices, read from the hub's own loop
+		for (int i = 0; i < opts->devices; i++) {
+			HMDHidInfo *info = malloc(sizeof(HMDHidInfo));
+			if (!info || fake_device_start(&fakes[i], info)) {
+				free(info);
+				break;
+			}
+			num_fakes++;
+			if (hub_add(hub, info, HID_KEEP_ALIVE_MARGIN)) {
+				free(info);
+				break;
+			}
+		}
+		if (hub->num_devices < opts->devices) {
+			hub_close(hub);
+			hub = NULL;
+		}
+	}
+	if (!hub) {
+		for (int i = 0; i < num_fakes; i++) {
+			fake_device_stop(&fakes[i]);
+		}
+		return 1;
+	}
+
+	double start = bench_now();
+	while (hub_running(hub) && bench_now() - start < opts->seconds) {
+		usleep(10000);
+	}
+	double elapsed = bench_now() - start;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+	for (int i = 0; i < hub->num_devices; i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "dev%d", i);
+		print_stats(name, &hub->devices[i]->stats);
+		total += hub->devices[i]->stats.num_reports;
+		threads += !hub->polled[i];
+	}
+	printf("%llu reports/s over %d devices, %d reader threads, "
+	       "%.1f%% of a CPU\n", (unsigned long long)(total / elapsed),
+	       hub->num_devices, threads,
+	       (cpu.tv_sec + cpu.tv_nsec * 1e-9) / elapsed * 100);
+
+	hub_close(hub);
+	for (int i = 0; i < num_fakes; i++) {
+		fake_device_stop(&fakes[i]);
+	}
+
+	return 0;
+}
+
+/* The pointer walking DK2 decoder the packet tables replaced */
+static int packet_reference(pkt_tracker_sensor * msg,
+			    const unsigned char *buffer, int size)
+{
+	if (size != TRACKER_REPORT_SIZE) {
+		return 0;
+	}
+
+	msg->last_command_id = buffer[1] | buffer[2] << 8;
+	msg->num_samples = buffer[3];
+	msg->temperature = buffer[6] | buffer[7] << 8;
+	msg->timestamp = buffer[8] | buffer[9] << 8 | buffer[10] << 16 |
+	    (uint32_t)buffer[11] << 24;
+	msg->num_samples = msg->num_samples < 2 ? msg->num_samples : 2;
+
+	for (int i = 0; i < msg->num_samples; i++) {
+		decode_sample(buffer + 12 + i * 16, msg->samples[i].accel);
+		decode_sample(buffer + 20 + i * 16, msg->samples[i].gyro);
+	}
+
+	for (int i = 0; i < 3; i++) {
+		msg->mag[i] = buffer[44 + i * 2] | buffer[45 + i * 2] << 8;
+	}
+
+	return 1;
+}
+
+static int packet_tables(pkt_tracker_sensor * msg,
+			 const unsigned char *buffer, int size)
+{
+	if (!pkt_tracker_dk2_decode(msg, buffer, size)) {
+		return 0;
+	}
+	msg->num_samples = msg->num_samples < 2 ? msg->num_samples : 2;
+
+	return 1;
+}
+
+static int packet_equal(const pkt_tracker_sensor * a,
+			const pkt_tracker_sensor * b)
+{
+	if (a->num_samples != b->num_samples
+	    || a->last_command_id != b->last_command_id
+	    || a->temperature != b->temperature
+	    || a->timestamp != b->timestamp
+	    || memcmp(a->mag, b->mag, sizeof(a->mag))) {
+		return 0;
+	}
+
+	return !memcmp(a->samples, b->samples,
+		       a->num_samples * sizeof(a->samples[0]));
+}
+
+static double packet_rate(int (*decode)(pkt_tracker_sensor *,
+					const unsigned char *, int),
+			  const unsigned char *reports, double seconds)
+{
+	pkt_tracker_sensor msg;
+	unsigned long long n = 0, ok = 0;
+	double start = bench_now(), elapsed;
+
+	do {
+		for (int i = 0; i < DECODE_REPORTS; i++) {
+			ok += decode(&msg, reports + i * TRACKER_REPORT_SIZE,
+				     TRACKER_REPORT_SIZE);
+			// keep the stores alive
+			ok += msg.samples[0].gyro[2] & 1;
+		}
+		n += DECODE_REPORTS;
+		elapsed = bench_now() - start;
+	} while (elapsed < seconds);
+
+	return ok ? n / elapsed : 0;
+}
+
+/* The first record at or after t by walking them all, to check rec_seek()
+   against */
+static uint64_t rec_scan(const hmd_rec * rec, double t)
+{
+	uint64_t i, count = rec_count(rec);
+	uint64_t ns = t <= 0 ? 0 : (uint64_t) (t * 1e9);
+
+	for (i = 0; i < count && rec_get(rec, i)->time_ns < ns; i++) ;
+
+	return i;
+}
+
+/* Seek a recording of a few index blocks by time against a linear scan,
+   with a look at the cost, and have rec_check() turn down headers whose
+   index points outside the file */
+static int bench_rec(const bench_options * opts)
+{
+	char path[] = "/tmp/pimax-bench-XXXXXX";
+	unsigned char report[REC_REPORT_SIZE] = { 0x0b };
+	int fd = mkstemp(path);
+	int mismatch = 0;
+
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	// 1 ms apart from 1 s on, like a headset's reports
+	hmd_rec *rec = rec_create(path, REC_RECORDS);
+	if (!rec) {
+		unlink(path);
+		return 1;
+	}
+	for (int i = 0; i < REC_RECORDS; i++) {
+		rec_write(rec, report, sizeof(report), 1.0 + i * 1e-3);
+	}
+	rec_close(rec);
+
+	if (!(rec = rec_open(path))) {
+		unlink(path);
+		return 1;
+	}
+
+	const struct {
+		const char *name;
+		double time;
+	} cases[] = {
+		{ "before the first", 0.5 },
+		{ "at the first", 1.0 },
+		{ "inside a block", 1.0 + 100.5e-3 },
+		{ "last of a block", 1.0 + (REC_INDEX_INTERVAL - 1) * 1e-3 },
+		{ "across a block", 1.0 + (REC_INDEX_INTERVAL - 0.5) * 1e-3 },
+		{ "first of a block", 1.0 + 2 * REC_INDEX_INTERVAL * 1e-3 },
+		{ "at the last", 1.0 + (REC_RECORDS - 1) * 1e-3 },
+		{ "past the end", 1.0 + REC_RECORDS * 1e-3 },
+	};
+	for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+		uint64_t got = rec_seek(rec, cases[i].time);
+		uint64_t want = rec_scan(rec, cases[i].time);
+		printf("%-18s %8.4f s -> record %5llu (scan %5llu)\n",
+		       cases[i].name, cases[i].time, (unsigned long long)got,
+		       (unsigned long long)want);
+		mismatch += got != want;
+	}
+
+	double *times = malloc(REC_SEEKS * sizeof(double));
+	uint64_t *found = malloc(REC_SEEKS * sizeof(uint64_t));
+	srand(1);
+	for (int i = 0; i < REC_SEEKS; i++) {
+		times[i] = 0.9 + (REC_RECORDS + 200) * 1e-3 * rand() / RAND_MAX;
+	}
+	double start = bench_now();
+	for (int i = 0; i < REC_SEEKS; i++) {
+		found[i] = rec_seek(rec, times[i]);
+	}
+	double elapsed = bench_now() - start;
+	for (int i = 0; i < REC_SEEKS; i += 97) {
+		mismatch += found[i] != rec_scan(rec, times[i]);
+	}
+	printf("%d random seeks, %.1f ns each\n", REC_SEEKS,
+	       elapsed / REC_SEEKS * 1e9);
+	free(times);
+	free(found);
+
+	// headers that would send rec_seek() through memory outside the map,
+	// and a last record that would send replay_read() past it
+	rec_header h = *rec->header;
+	const struct {
+		const char *name;
+		uint64_t index_offset, records_offset, capacity;
+		uint32_t last_size;
+	} bad[] = {
+		{ "index in the header", 0, h.records_offset, h.capacity,
+		  REC_REPORT_SIZE },
+		{ "index past records", h.records_offset + 8, h.records_offset,
+		  h.capacity, REC_REPORT_SIZE },
+		{ "index too small", h.index_offset, h.index_offset + 8,
+		  h.capacity, REC_REPORT_SIZE },
+		{ "records past the end", h.index_offset, rec->map_size + 4096,
+		  h.capacity, REC_REPORT_SIZE },
+		{ "count over capacity", h.index_offset, h.records_offset,
+		  REC_RECORDS - 1, REC_REPORT_SIZE },
+		{ "oversized record", h.index_offset, h.records_offset,
+		  h.capacity, 256 },
+		{ "empty record", h.index_offset, h.records_offset,
+		  h.capacity, 0 },
+	};
+	unsigned char *copy = malloc(rec->map_size);
+	rec_record *last = (rec_record *) (copy + h.records_offset) +
+	    REC_RECORDS - 1;
+	for (int i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+		rec_header *c = (rec_header *) copy;
+
+		memcpy(copy, rec->map, rec->map_size);
+		c->index_offset = bad[i].index_offset;
+		c->records_offset = bad[i].records_offset;
+		c->capacity = bad[i].capacity;
+		last->size = bad[i].last_size;
+		int res = rec_check(copy, rec->map_size);
+		printf("%-20s %s\n", bad[i].name, res ? "rejected" : "ACCEPTED");
+		mismatch += !res;
+	}
+	mismatch += rec_check(rec->map, rec->map_size) != 0;
+	free(copy);
+
+	rec_close(rec);
+	unlink(path);
+
+	printf("%s\n", mismatch ? "MISMATCH" : "all seeks match the scan");
+
+	return mismatch ? 1 : 0;
+}
+
+/* Table generated DK2 decoder against the hand written one it replaced */
+static int bench_packet(const bench_options * opts)
+{
+	unsigned char *reports = malloc(DECODE_REPORTS * TRACKER_REPORT_SIZE);
+	unsigned seed = 1;
+	int mismatch = 0;
+
+	for (int i = 0; i < DECODE_REPORTS * TRACKER_REPORT_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		reports[i] = seed >> 16;
+	}
+
+	for (int i = 0; i < DECODE_REPORTS; i++) {
+		pkt_tracker_sensor ref, tab;
+		const unsigned char *r = reports + i * TRACKER_REPORT_SIZE;
+
+		memset(&ref, 0, sizeof(ref));
+		memset(&tab, 0, sizeof(tab));
+		packet_reference(&ref, r, TRACKER_REPORT_SIZE);
+		packet_tables(&tab, r, TRACKER_REPORT_SIZE);
+		if (!packet_equal(&ref, &tab)) {
+			mismatch++;
+		}
+	}
+
+	double ref_rate = packet_rate(packet_reference, reports,
+				      opts->seconds / 2);
+	double tab_rate = packet_rate(packet_tables, reports,
+				      opts->seconds / 2);
+
+	printf("packet   %s\n", mismatch ? "MISMATCH" : "identical");
+	printf("         hand written %.1f M reports/s  tables %.1f M reports/s\n",
+	       ref_rate * 1e-6, tab_rate * 1e-6);
+
+	free(reports);
+
+	return mismatch ? 1 : 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-s seconds] [-r capture.pcap] [-f] [-n devices] [-b backend] [-q] <benchmark>\n",
+		name);
+	fprintf(stderr, "  reader   poll loop vs reader thread latency\n");
+	fprintf(stderr, "  pose     latest pose publication under concurrent readers\n");
+	fprintf(stderr, "  fusion   orientation filter cost per IMU sample\n");
+	fprintf(stderr, "  calib    gyro bias learning against the filter alone\n");
+	fprintf(stderr, "  magcal   magnetometer fit and the yaw drift it removes\n");
+	fprintf(stderr, "  history  pose at an arbitrary time, slerped against the sample before\n");
+	fprintf(stderr, "  fwquat   folded firmware quaternion decoder against the vendor's\n");
+	fprintf(stderr, "  decode   batch sample decoder exactness and throughput\n");
+	fprintf(stderr, "  packet   table generated report decoder against the old one\n");
+	fprintf(stderr, "  rec      recording seek by time against a scan, corrupt headers\n");
+	fprintf(stderr, "  clock    device clock fit of a replay\n");
+	fprintf(stderr, "  hub      latency of -n devices replaying at once, or of fake\n");
+	fprintf(stderr, "           hidraw devices read from the hub's loop with -b fake\n");
+	fprintf(stderr, "  lib      -n trackers through the library API, then open/close cycles\n");
+	fprintf(stderr, "  rt       reader wake-up under CPU load, with and without real-time\n");
+	fprintf(stderr, "  accuracy fused orientation of a replay against the firmware's,\n");
+	fprintf(stderr, "           or without -r of a synthetic motion against the truth,\n");
+	fprintf(stderr, "           resting tilt and yaw drift, CPU time per sample;\n");
+	fprintf(stderr, "           fails past the MAX_ limits in bench.c\n");
+	fprintf(stderr, "  init     startup with and without a cached config\n");
+	fprintf(stderr, "  pipeline per-stage latency percentiles of a replay (-f: fast)\n");
+	fprintf(stderr, "           or of a headset over -b hidapi, hidraw or fake\n");
+	fprintf(stderr, "           (-q: on the firmware orientation)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bench_options opts = { NULL, 10.0, REPLAY_REALTIME, 8, NULL, 0 };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:s:fn:b:qh")) != -1) {
+		switch (opt) {
+		case 'r':
+			opts.replay_file = optarg;
+			break;
+		case 's':
+			opts.seconds = atof(optarg);
+			break;
+		case 'f':
+			opts.mode = REPLAY_FAST;
+			break;
+		case 'n':
+			opts.devices = atoi(optarg);
+			break;
+		case 'b':
+			opts.backend = optarg;
+			break;
+		case 'q':
+			opts.firmware = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char *name = argv[optind];
+
+	if (!strcmp(name, "reader") && opts.replay_file) {
+		return bench_reader(&opts);
+	} else if (!strcmp(name, "pose")) {
+		return bench_pose(&opts);
+	} else if (!strcmp(name, "fusion")) {
+		return bench_fusion(&opts);
+	} else if (!strcmp(name, "calib")) {
+		return bench_calib(&opts);
+	} else if (!strcmp(name, "magcal")) {
+		return bench_magcal(&opts);
+	} else if (!strcmp(name, "history")) {
+		return bench_history(&opts);
+	} else if (!strcmp(name, "fwquat")) {
+		return bench_fwquat(&opts);
+	} else if (!strcmp(name, "decode")) {
+		return bench_decode(&opts);
+	} else if (!strcmp(name, "rec")) {
+		return bench_rec(&opts);
+	} else if (!strcmp(name, "packet")) {
+		return bench_packet(&opts);
+	} else if (!strcmp(name, "lib") && opts.replay_file) {
+		return bench_lib(&opts);
+	} else if (!strcmp(name, "rt") && opts.replay_file) {
+		return bench_rt(&opts);
+	} else if (!strcmp(name, "hub")
+		   && (opts.replay_file || (opts.backend
+					    && !strcmp(opts.backend, "fake")))) {
+		return bench_hub(&opts);
+	} else if (!strcmp(name, "accuracy")) {
+		return bench_accuracy(&opts);
+	} else if (!strcmp(name, "init") && opts.replay_file) {
+		return bench_init(&opts);
+	} else if (!strcmp(name, "clock") && opts.replay_file) {
+		return bench_clock(&opts);
+	} else if (!strcmp(name, "pipeline")
+		   && (opts.replay_file || opts.backend)) {
+		return bench_pipeline(&opts);
+	}
+
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "log.h"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t reserved;
+} cache_header;
+
+static int cache_dir(char *path, size_t size)
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+
+	if (xdg && *xdg) {
+		n = snprintf(path, size, "%s/%s", xdg, CACHE_DIR);
+	} else if (home && *home) {
+		n = snprintf(path, size, "%s/.cache/%s", home, CACHE_DIR);
+	} else {
+		return -1;
+	}
+
+	return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+static int cache_path(char *path, size_t size, const char *serial,
+		      const char *kind)
+{
+	char dir[4096];
+
+	if (!serial || !*serial || cache_dir(dir, sizeof(dir))) {
+		return -1;
+	}
+
+	// serials come from the device, keep them out of the directory tree
+	char name[CACHE_SERIAL_MAX];
+	int i;
+	for (i = 0; serial[i] && i < CACHE_SERIAL_MAX - 1; i++) {
+		char c = serial[i];
+		int ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+		    || (c >= 'A' && c <= 'Z') || c == '-' || c == '_';
+		name[i] = ok ? c : '_';
+	}
+	name[i] = 0;
+
+	int n = snprintf(path, size, "%s/%s.%s", dir, name, kind);
+	return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+int cache_load(const char *serial, const char *kind, uint32_t magic,
+	       uint32_t version, void *data, size_t size)
+{
+	char path[4096];
+	cache_header h;
+
+	if (cache_path(path, sizeof(path), serial, kind)) {
+		return -1;
+	}
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return -1;
+	}
+
+	int ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == magic
+	    && h.version == version && h.size == size
+	    && fread(data, size, 1, f) == 1;
+	fclose(f);
+
+	if (!ok) {
+		LOGW("cache: ignoring stale %s", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int cache_store(const char *serial, const char *kind, uint32_t magic,
+		uint32_t version, const void *data, size_t size)
+{
+	char dir[4096], path[4096], tmp[4200];
+	cache_header h = { magic, version, size, 0 };
+
+	if (cache_dir(dir, sizeof(dir))
+	    || cache_path(path, sizeof(path), serial, kind)) {
+		return -1;
+	}
+
+	// ~/.cache may not exist yet either
+	char *slash = strrchr(dir, '/');
+	if (slash) {
+		*slash = 0;
+		mkdir(dir, 0755);
+		*slash = '/';
+	}
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		LOGW("cache: could not create %s", dir);
+		return -1;
+	}
+
+	// write a temporary file and rename it so readers never see half
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	FILE *f = fopen(tmp, "wb");
+	if (!f) {
+		LOGW("cache: could not write %s", tmp);
+		return -1;
+	}
+
+	int ok = fwrite(&h, sizeof(h), 1, f) == 1
+	    && fwrite(data, size, 1, f) == 1;
+	ok = !fclose(f) && ok;
+
+	if (!ok || rename(tmp, path)) {
+		LOGW("cache: could not write %s", path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
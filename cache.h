@@ -0,0 +1,21 @@
+/* Small per-device files under $XDG_CACHE_HOME/pimax-tracker (or
+   ~/.cache/pimax-tracker), named after the headset serial. Each holds one
+   fixed-size blob behind a magic and version, so stale or foreign files
+   read as a miss. */
+
+#ifndef __HMD_CACHE__
+#define __HMD_CACHE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_DIR "pimax-tracker"
+#define CACHE_SERIAL_MAX 64
+
+/* Returns 0 and fills data on a hit, -1 on a miss */
+int cache_load(const char *serial, const char *kind, uint32_t magic,
+	       uint32_t version, void *data, size_t size);
+int cache_store(const char *serial, const char *kind, uint32_t magic,
+		uint32_t version, const void *data, size_t size);
+
+#endif
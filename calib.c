@@ -0,0 +1,168 @@
+#include <string.h>
+#include <math.h>
+
+#include "calib.h"
+#include "cache.h"
+#include "log.h"
+
+#define CALIB_CACHE_MAGIC 0x52594750	// "PGYR"
+#define CALIB_CACHE_VERSION 1
+
+// time constant of the low pass the stillness test compares against
+#define CALIB_AVG_ALPHA 0.02f
+
+// still means every sample stays this close to the low passed values...
+#define CALIB_GYRO_NOISE 0.05f	// rad/s
+#define CALIB_ACCEL_NOISE 0.3f	// m/s^2
+// ...and the gyro reads something a bias could plausibly be
+#define CALIB_BIAS_MAX 0.1f	// rad/s
+// ...close to the bias already known, or a slow steady turn would pass
+#define CALIB_BIAS_STEP 0.02f	// rad/s
+// ...while the accelerometer reads gravity alone, give or take its scale,
+// which nothing calibrates
+#define CALIB_GRAVITY 9.81f	// m/s^2
+#define CALIB_GRAVITY_TOL 1.0f	// m/s^2
+
+// only learn once the head has been still this long, at 1 kHz
+#define CALIB_STILL_SAMPLES 250
+
+// average over at most this many samples, so the bins keep up with aging
+#define CALIB_WEIGHT_MAX 20000.0f
+// an empty bin starts from its neighbours as if from this many samples
+#define CALIB_SEED_WEIGHT 250.0f
+
+static float distance(const vec3f * a, const vec3f * b)
+{
+	vec3f d = { {a->x - b->x, a->y - b->y, a->z - b->z} };
+	return ovec3f_get_length(&d);
+}
+
+static int temperature_bin(int16_t temperature)
+{
+	int bin = temperature / 100 - CALIB_TEMP_MIN;
+
+	return bin < 0 ? 0 : bin >= CALIB_TEMP_BINS ? CALIB_TEMP_BINS - 1 : bin;
+}
+
+/* The bin itself once it has samples, else linear between the nearest
+   bins on either side that have, else whichever side has one. Returns 0
+   if no bin has samples. */
+static int interpolate(const gyro_calib_table * t, int bin, vec3f * out)
+{
+	int lo = bin, hi = bin;
+
+	while (lo >= 0 && t->bin[lo].weight == 0) {
+		lo--;
+	}
+	while (hi < CALIB_TEMP_BINS && t->bin[hi].weight == 0) {
+		hi++;
+	}
+
+	if (lo < 0 && hi >= CALIB_TEMP_BINS) {
+		memset(out, 0, sizeof(*out));
+		return 0;
+	} else if (lo < 0 || lo == hi) {
+		*out = t->bin[hi].bias;
+	} else if (hi >= CALIB_TEMP_BINS) {
+		*out = t->bin[lo].bias;
+	} else {
+		float f = (float)(bin - lo) / (hi - lo);
+		for (int i = 0; i < 3; i++) {
+			out->arr[i] = t->bin[lo].bias.arr[i] +
+			    f * (t->bin[hi].bias.arr[i] - t->bin[lo].bias.arr[i]);
+		}
+	}
+
+	return 1;
+}
+
+void calib_init(gyro_calib * c)
+{
+	memset(c, 0, sizeof(gyro_calib));
+	c->bin = -1;
+}
+
+int calib_load(gyro_calib * c, const char *serial)
+{
+	gyro_calib_table table;
+
+	if (cache_load(serial, "gyro", CALIB_CACHE_MAGIC, CALIB_CACHE_VERSION,
+		       &table, sizeof(table))) {
+		return -1;
+	}
+
+	c->table = table;
+	c->bin = -1;
+	c->dirty = 0;
+
+	return 0;
+}
+
+int calib_store(gyro_calib * c, const char *serial)
+{
+	if (cache_store(serial, "gyro", CALIB_CACHE_MAGIC, CALIB_CACHE_VERSION,
+			&c->table, sizeof(c->table))) {
+		return -1;
+	}
+
+	c->dirty = 0;
+
+	return 0;
+}
+
+void calib_update(gyro_calib * c, int16_t temperature, const vec3f * gyro,
+		  const vec3f * accel, vec3f * out)
+{
+	int bin = temperature_bin(temperature);
+
+	if (bin != c->bin) {
+		c->bin = bin;
+		c->known = interpolate(&c->table, bin, &c->bias);
+	}
+
+	if (distance(gyro, &c->gyro_avg) < CALIB_GYRO_NOISE
+	    && distance(accel, &c->accel_avg) < CALIB_ACCEL_NOISE
+	    && ovec3f_get_length(gyro) < CALIB_BIAS_MAX
+	    && (!c->known || distance(&c->gyro_avg, &c->bias) < CALIB_BIAS_STEP)
+	    && fabsf(ovec3f_get_length(accel) - CALIB_GRAVITY) <
+	    CALIB_GRAVITY_TOL) {
+		c->still++;
+	} else {
+		c->still = 0;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		c->gyro_avg.arr[i] += CALIB_AVG_ALPHA *
+		    (gyro->arr[i] - c->gyro_avg.arr[i]);
+		c->accel_avg.arr[i] += CALIB_AVG_ALPHA *
+		    (accel->arr[i] - c->accel_avg.arr[i]);
+	}
+
+	if (c->still >= CALIB_STILL_SAMPLES) {
+		gyro_calib_bin *b = &c->table.bin[bin];
+
+		// an empty bin starts out at what its neighbours say
+		if (b->weight == 0) {
+			LOGI("calib: learning the gyro bias at %d C",
+			     bin + CALIB_TEMP_MIN);
+			if (c->known) {
+				b->bias = c->bias;
+				b->weight = CALIB_SEED_WEIGHT;
+			}
+		}
+		if (b->weight < CALIB_WEIGHT_MAX) {
+			b->weight++;
+		}
+		for (int i = 0; i < 3; i++) {
+			b->bias.arr[i] += (gyro->arr[i] - b->bias.arr[i]) /
+			    b->weight;
+		}
+		c->bias = b->bias;
+		c->known = 1;
+		c->dirty = 1;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		out->arr[i] = gyro->arr[i] - c->bias.arr[i];
+	}
+}
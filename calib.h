@@ -0,0 +1,47 @@
+/* Host side gyro bias estimation. Whenever the headset lies still the gyro
+   reads nothing but its bias, which drifts with temperature; those samples
+   are averaged into a table of 1 degree bins. The table is cached per
+   serial, so a known headset starts out with the bias already removed. */
+
+#ifndef __HMD_CALIB__
+#define __HMD_CALIB__
+
+#include <stdint.h>
+
+#include "omath.h"
+
+#define CALIB_TEMP_MIN 0	// degrees C of the first bin
+#define CALIB_TEMP_BINS 64
+
+typedef struct {
+	vec3f bias;		// rad/s
+	float weight;		// still samples averaged in, capped
+} gyro_calib_bin;
+
+/* What the cache holds */
+typedef struct {
+	gyro_calib_bin bin[CALIB_TEMP_BINS];
+} gyro_calib_table;
+
+typedef struct {
+	gyro_calib_table table;
+	vec3f gyro_avg, accel_avg;	// low passed, for the stillness test
+	uint32_t still;		// consecutive still samples
+	int bin;		// of the last temperature seen, -1 before
+	vec3f bias;		// the table interpolated at that bin
+	int known;		// some bin has samples, bias is not a guess
+	int dirty;		// learned something since the last load or store
+} gyro_calib;
+
+void calib_init(gyro_calib * c);
+
+/* Returns 0 if the table of this serial was restored, -1 otherwise */
+int calib_load(gyro_calib * c, const char *serial);
+int calib_store(gyro_calib * c, const char *serial);
+
+/* Feed one IMU sample, temperature as reported (1/100 degree C). Writes the
+   angular velocity with the estimated bias removed to out. */
+void calib_update(gyro_calib * c, int16_t temperature, const vec3f * gyro,
+		  const vec3f * accel, vec3f * out);
+
+#endif
@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "replay.h"
+#include "packet.h"
+#include "decode.h"
+#include "fusion.h"
+
+/*
+ * Offline conversion of a capture or recording: every IMU sample of its
+ * tracker reports goes to one raw array per field, native byte order,
+ * <prefix>.<field>.<type>, and optionally to CSV.
+ *
+ * The capture is mapped and indexed in one pass over its record headers,
+ * which also settles from the DK2 sample counter which slots of a report
+ * are new and where each report's rows go. Decoding and CSV formatting then
+ * run on every core, each thread on its own range of reports or rows. Only
+ * the orientation filter, which needs the samples in order, runs on one.
+ */
+
+#define MAX_THREADS 64
+#define SAMPLE_PERIOD_US 1000	// DK2 trackers sample at 1 kHz
+#define MAX_FUSE_DT 0.05f	// s, longer steps restart from the nominal one
+#define CSV_ROW_MAX 512	// 15 fields of at most 18 characters
+#define FIXED_MAX 1e15		// larger fixed point values go to printf
+
+typedef struct {
+	double *time;		// capture time of the report, s from the first
+	uint32_t *timestamp;	// device time of the sample, us
+	float *accel[3], *gyro[3], *mag[3];
+	float *quat[4];		// x y z w of the host filter
+} columns;
+
+typedef struct {
+	const hmd_replay *replay;
+	const int64_t *row;	// first row of each report, -1 if not a tracker
+	const uint8_t *first;	// first new slot of each report
+	const columns *out;
+	int64_t begin, end;	// reports to decode, or rows to format
+	char *csv;
+	size_t csv_len;
+	pthread_t thread;
+} chunk;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void *decode_chunk(void *arg)
+{
+	chunk *c = arg;
+	const columns *out = c->out;
+	pkt_tracker_sensor msg;
+
+	for (int64_t i = c->begin; i < c->end; i++) {
+		const unsigned char *data;
+		double time;
+		int size = replay_report(c->replay, i, &data, &time);
+
+		if (c->row[i] < 0 || !pkt_tracker_dk2_decode(&msg, data, size)) {
+			continue;
+		}
+
+		int num = msg.num_samples < TRACKER_REPORT_SLOTS ?
+		    msg.num_samples : TRACKER_REPORT_SLOTS;
+		int32_t mag32[] = { msg.mag[0], msg.mag[1], msg.mag[2] };
+		vec3f mag;
+		vec3f_from_rift_vec(mag32, &mag);
+
+		int64_t r = c->row[i];
+		for (int slot = c->first[i]; slot < num; slot++, r++) {
+			vec3f accel, gyro;
+			vec3f_from_rift_vec(msg.samples[slot].accel, &accel);
+			vec3f_from_rift_vec(msg.samples[slot].gyro, &gyro);
+
+			out->time[r] = time;
+			out->timestamp[r] = msg.timestamp -
+			    (num - 1 - slot) * SAMPLE_PERIOD_US;
+			for (int k = 0; k < 3; k++) {
+				out->accel[k][r] = accel.arr[k];
+				out->gyro[k][r] = gyro.arr[k];
+				out->mag[k][r] = mag.arr[k];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* v with a fixed number of decimals; printf's float formatting would take
+   most of the conversion time */
+static char *put_fixed(char *p, double v, int decimals)
+{
+	static const uint64_t scales[] = { 1, 10, 100, 1000, 10000, 100000,
+		1000000, 10000000
+	};
+	uint64_t scale = scales[decimals];
+	char digits[24];
+	int n = 0;
+
+	// NaN or a diverged filter; rare, and past what fits 64 bits
+	if (!(fabs(v) * scale < FIXED_MAX)) {
+		return p + (isfinite(v) ? sprintf(p, "%.*e,", decimals, v) :
+			    sprintf(p, "%f,", v));
+	}
+
+	if (v < 0) {
+		*p++ = '-';
+		v = -v;
+	}
+
+	uint64_t x = (uint64_t)(v * scale + 0.5);
+	uint64_t whole = x / scale, frac = x % scale;
+
+	do {
+		digits[n++] = '0' + whole % 10;
+		whole /= 10;
+	} while (whole);
+	while (n) {
+		*p++ = digits[--n];
+	}
+
+	if (decimals) {
+		*p++ = '.';
+		for (int i = decimals - 1; i >= 0; i--) {
+			p[i] = '0' + frac % 10;
+			frac /= 10;
+		}
+		p += decimals;
+	}
+	*p++ = ',';
+
+	return p;
+}
+
+static void *format_chunk(void *arg)
+{
+	chunk *c = arg;
+	const columns *out = c->out;
+
+	c->csv = malloc((c->end - c->begin) * CSV_ROW_MAX + 1);
+	if (!c->csv) {
+		return NULL;
+	}
+
+	char *p = c->csv;
+	for (int64_t r = c->begin; r < c->end; r++) {
+		p = put_fixed(p, out->time[r], 6);
+		p = put_fixed(p, out->timestamp[r], 0);
+		// rift vectors come in steps of 1e-4
+		for (int k = 0; k < 3; k++) {
+			p = put_fixed(p, out->accel[k][r], 4);
+		}
+		for (int k = 0; k < 3; k++) {
+			p = put_fixed(p, out->gyro[k][r], 4);
+		}
+		for (int k = 0; k < 3; k++) {
+			p = put_fixed(p, out->mag[k][r], 4);
+		}
+		for (int k = 0; k < 4; k++) {
+			p = put_fixed(p, out->quat[k][r], 7);
+		}
+		p[-1] = '\n';
+	}
+	c->csv_len = p - c->csv;
+
+	return NULL;
+}
+
+/* Run fn over count items split evenly across threads */
+static void run_chunks(chunk * chunks, int threads, int64_t count,
+		       void *(*fn)(void *))
+{
+	for (int t = 0; t < threads; t++) {
+		chunks[t].begin = count * t / threads;
+		chunks[t].end = count * (t + 1) / threads;
+		if (pthread_create(&chunks[t].thread, NULL, fn, &chunks[t])) {
+			fn(&chunks[t]);
+			chunks[t].thread = 0;
+		}
+	}
+	for (int t = 0; t < threads; t++) {
+		if (chunks[t].thread) {
+			pthread_join(chunks[t].thread, NULL);
+		}
+	}
+}
+
+/* The filter steps from sample to sample by their device times */
+static void fuse(const columns * out, int64_t rows)
+{
+	fusion f;
+
+	ofusion_init(&f);
+	for (int64_t r = 0; r < rows; r++) {
+		float dt = r ? (int32_t)(out->timestamp[r] -
+					 out->timestamp[r - 1]) * 1e-6f : 0;
+		if (dt <= 0 || dt > MAX_FUSE_DT) {
+			dt = SAMPLE_PERIOD_US * 1e-6f;
+		}
+
+		vec3f accel = { {out->accel[0][r], out->accel[1][r],
+				 out->accel[2][r]} };
+		vec3f gyro = { {out->gyro[0][r], out->gyro[1][r],
+				out->gyro[2][r]} };
+		ofusion_update(&f, dt, &gyro, &accel, NULL);
+
+		for (int k = 0; k < 4; k++) {
+			out->quat[k][r] = f.orient.arr[k];
+		}
+	}
+}
+
+static int write_column(const char *prefix, const char *name,
+			const void *data, size_t size, int64_t rows)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.%s", prefix, name);
+
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	int res = fwrite(data, size, rows, f) == (size_t)rows ? 0 : -1;
+	if (fclose(f) || res) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_columns(const char *prefix, const columns * out,
+			 int64_t rows)
+{
+	static const char *xyz[] = { "x", "y", "z", "w" };
+	char name[64];
+	int res = write_column(prefix, "time.f64", out->time, sizeof(double),
+			       rows)
+	    || write_column(prefix, "timestamp.u32", out->timestamp,
+			    sizeof(uint32_t), rows);
+
+	for (int k = 0; k < 4 && !res; k++) {
+		if (k < 3) {
+			snprintf(name, sizeof(name), "accel_%s.f32", xyz[k]);
+			res |= write_column(prefix, name, out->accel[k],
+					    sizeof(float), rows);
+			snprintf(name, sizeof(name), "gyro_%s.f32", xyz[k]);
+			res |= write_column(prefix, name, out->gyro[k],
+					    sizeof(float), rows);
+			snprintf(name, sizeof(name), "mag_%s.f32", xyz[k]);
+			res |= write_column(prefix, name, out->mag[k],
+					    sizeof(float), rows);
+		}
+		snprintf(name, sizeof(name), "quat_%s.f32", xyz[k]);
+		res |= write_column(prefix, name, out->quat[k], sizeof(float),
+				    rows);
+	}
+
+	return res ? -1 : 0;
+}
+
+static int write_csv(const char *path, chunk * chunks, int threads)
+{
+	FILE *f = fopen(path, "w");
+	int res = 0;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	fputs("time,timestamp,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z,"
+	      "mag_x,mag_y,mag_z,quat_x,quat_y,quat_z,quat_w\n", f);
+	for (int t = 0; t < threads; t++) {
+		if (!chunks[t].csv
+		    || fwrite(chunks[t].csv, 1, chunks[t].csv_len, f) !=
+		    chunks[t].csv_len) {
+			res = -1;
+		}
+		free(chunks[t].csv);
+		chunks[t].csv = NULL;
+	}
+
+	if (fclose(f) || res) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-c file.csv] capture prefix\n",
+		name);
+	fprintf(stderr, "  writes prefix.time.f64, prefix.timestamp.u32 and prefix.{accel,gyro,mag}_{x,y,z}.f32,\n");
+	fprintf(stderr, "  prefix.quat_{x,y,z,w}.f32: one value per IMU sample each\n");
+	fprintf(stderr, "  -j n     decode on n threads (default: every core)\n");
+	fprintf(stderr, "  -c file  also write the samples as CSV\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	const char *csv_file = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:c:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			csv_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind + 2 != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS :
+	    threads;
+
+	struct stat st;
+	if (stat(argv[optind], &st)) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	double start = now();
+	hmd_replay *replay = replay_open(argv[optind], REPLAY_FAST);
+	if (!replay) {
+		return 1;
+	}
+
+	// which slots are new, see handle_tracker_sensor_msg()
+	int64_t reports = replay_num_reports(replay);
+	int64_t *row = malloc(reports * sizeof(int64_t));
+	uint8_t *first = malloc(reports);
+	int64_t rows = 0, repeated = 0, skipped = 0;
+	if ((!row || !first) && reports) {
+		fprintf(stderr, "out of memory for %lld reports\n",
+			(long long)reports);
+		free(row);
+		free(first);
+		replay_close(replay);
+		return 1;
+	}
+	uint16_t count = 0;
+	int have_count = 0;
+
+	for (int64_t i = 0; i < reports; i++) {
+		const unsigned char *data;
+		double time;
+		int size = replay_report(replay, i, &data, &time);
+
+		row[i] = -1;
+		if (size < PKT_TRACKER_DK2_SIZE
+		    || data[0] != RIFT_IRQ_SENSORS_DK2) {
+			skipped++;
+			continue;
+		}
+
+		int num = pkt_tracker_dk2_num_samples(data);
+		num = num < TRACKER_REPORT_SLOTS ? num : TRACKER_REPORT_SLOTS;
+		uint16_t c = pkt_tracker_dk2_sample_count(data);
+		int taken = have_count ? (uint16_t)(c - count) : num;
+		count = c;
+		have_count = 1;
+
+		first[i] = num > taken ? num - taken : 0;
+		row[i] = rows;
+		rows += num - first[i];
+		repeated += first[i];
+	}
+	double indexed = now();
+
+	columns out;
+	void *mem[17];
+	int n = 0;
+	mem[n++] = out.time = malloc(rows * sizeof(double));
+	mem[n++] = out.timestamp = malloc(rows * sizeof(uint32_t));
+	for (int k = 0; k < 4; k++) {
+		if (k < 3) {
+			mem[n++] = out.accel[k] = malloc(rows * sizeof(float));
+			mem[n++] = out.gyro[k] = malloc(rows * sizeof(float));
+			mem[n++] = out.mag[k] = malloc(rows * sizeof(float));
+		}
+		mem[n++] = out.quat[k] = malloc(rows * sizeof(float));
+	}
+	for (int i = 0; i < n; i++) {
+		if (!mem[i] && rows) {
+			fprintf(stderr, "out of memory for %lld samples\n",
+				(long long)rows);
+			for (i = 0; i < n; i++) {
+				free(mem[i]);
+			}
+			free(row);
+			free(first);
+			replay_close(replay);
+			return 1;
+		}
+	}
+
+	chunk chunks[MAX_THREADS];
+	for (int t = 0; t < threads; t++) {
+		chunks[t] = (chunk) {
+		replay, row, first, &out, 0, 0, NULL, 0, 0};
+	}
+
+	run_chunks(chunks, threads, reports, decode_chunk);
+	double decoded = now();
+
+	fuse(&out, rows);
+	double fused = now();
+
+	int res = write_columns(argv[optind + 1], &out, rows);
+	if (!res && csv_file) {
+		run_chunks(chunks, threads, rows, format_chunk);
+		res = write_csv(csv_file, chunks, threads);
+	}
+	double written = now();
+
+	fprintf(stderr, "%lld reports, %lld samples (%lld repeated slots "
+		"dropped, %lld other reports) on %d threads\n",
+		(long long)reports, (long long)rows, (long long)repeated,
+		(long long)skipped, threads);
+	fprintf(stderr, "index %.1f ms, decode %.1f ms, fuse %.1f ms, "
+		"write %.1f ms: %.0f MB/s of capture, %.0f MB/s written\n",
+		(indexed - start) * 1e3, (decoded - indexed) * 1e3,
+		(fused - decoded) * 1e3, (written - fused) * 1e3,
+		st.st_size / (fused - start) / 1e6,
+		st.st_size / (written - start) / 1e6);
+
+	for (int i = 0; i < n; i++) {
+		free(mem[i]);
+	}
+	free(row);
+	free(first);
+	replay_close(replay);
+
+	return res ? 1 : 0;
+}
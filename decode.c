@@ -0,0 +1,346 @@
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "decode.h"
+
+#define RIFT_SCALE 0.0001f
+
+void decode_sample(const unsigned char *buffer, int32_t * smp)
+{
+	/*
+	 * Decode 3 tightly packed 21 bit values from 4 bytes.
+	 * We unpack them in the higher 21 bit values first and then shift
+	 * them down to the lower in order to get the sign bits correct.
+	 */
+
+	uint32_t x =
+	    ((uint32_t)buffer[0] << 24) | (buffer[1] << 16) |
+	    ((buffer[2] & 0xF8) << 8);
+	uint32_t y =
+	    ((uint32_t)(buffer[2] & 0x07) << 29) | (buffer[3] << 21) |
+	    (buffer[4] << 13) | ((buffer[5] & 0xC0) << 5);
+	uint32_t z =
+	    ((uint32_t)(buffer[5] & 0x3F) << 26) | (buffer[6] << 18) |
+	    (buffer[7] << 10);
+
+	smp[0] = (int32_t)x >> 11;
+	smp[1] = (int32_t)y >> 11;
+	smp[2] = (int32_t)z >> 11;
+}
+
+// TODO do we need to consider HMD vs sensor "centric" values
+void vec3f_from_rift_vec(const int32_t * smp, vec3f * out_vec)
+{
+	out_vec->x = (float)smp[0] * RIFT_SCALE;
+	out_vec->y = (float)smp[1] * RIFT_SCALE;
+	out_vec->z = (float)smp[2] * RIFT_SCALE;
+}
+
+/*
+ * The vector versions take each 21 bit value from the big endian 32 bit
+ * word holding its first byte: x starts at byte 0, y at bit 2 of byte 2
+ * and z at bit 5 of byte 5. Shifting the word left by 0, 5 or 10 puts the
+ * value at the top and an arithmetic shift right by 11 sign extends it,
+ * exactly like decode_sample().
+ */
+
+static inline int32_t load_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (int32_t) __builtin_bswap32(v);
+}
+
+static int decode_batch_scalar(const unsigned char *reports, int first,
+			       int count, const tracker_samples_soa * out)
+{
+	int32_t smp[3];
+	vec3f v;
+
+	for (int i = first * TRACKER_REPORT_SLOTS;
+	     i < count * TRACKER_REPORT_SLOTS; i++) {
+		const unsigned char *p = reports +
+		    (i / TRACKER_REPORT_SLOTS) * TRACKER_REPORT_SIZE +
+		    TRACKER_SAMPLE_OFFSET + (i % TRACKER_REPORT_SLOTS) * 16;
+
+		decode_sample(p, smp);
+		vec3f_from_rift_vec(smp, &v);
+		out->accel_x[i] = v.x;
+		out->accel_y[i] = v.y;
+		out->accel_z[i] = v.z;
+
+		decode_sample(p + 8, smp);
+		vec3f_from_rift_vec(smp, &v);
+		out->gyro_x[i] = v.x;
+		out->gyro_y[i] = v.y;
+		out->gyro_z[i] = v.z;
+	}
+
+	return count;
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+
+__attribute__((target("avx2")))
+static inline void avx2_field(const unsigned char *base, int offset,
+			      int shift, float *out)
+{
+	const unsigned char *p = base + offset;
+	__m256i v = _mm256_setr_epi32(load_be32(p), load_be32(p + 16),
+				      load_be32(p + TRACKER_REPORT_SIZE),
+				      load_be32(p + TRACKER_REPORT_SIZE + 16),
+				      load_be32(p + 2 * TRACKER_REPORT_SIZE),
+				      load_be32(p + 2 * TRACKER_REPORT_SIZE + 16),
+				      load_be32(p + 3 * TRACKER_REPORT_SIZE),
+				      load_be32(p + 3 * TRACKER_REPORT_SIZE + 16));
+
+	v = _mm256_srai_epi32(_mm256_sll_epi32(v, _mm_cvtsi32_si128(shift)),
+			      11);
+	_mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(v),
+					    _mm256_set1_ps(RIFT_SCALE)));
+}
+
+// 4 reports, 8 slots at a time
+__attribute__((target("avx2")))
+static int decode_batch_avx2(const unsigned char *reports, int count,
+			     const tracker_samples_soa * out)
+{
+	int n = count & ~3;
+
+	for (int r = 0; r < n; r += 4) {
+		const unsigned char *base = reports + r * TRACKER_REPORT_SIZE +
+		    TRACKER_SAMPLE_OFFSET;
+		int i = r * TRACKER_REPORT_SLOTS;
+
+		avx2_field(base, 0, 0, out->accel_x + i);
+		avx2_field(base, 2, 5, out->accel_y + i);
+		avx2_field(base, 4, 10, out->accel_z + i);
+		avx2_field(base, 8, 0, out->gyro_x + i);
+		avx2_field(base, 10, 5, out->gyro_y + i);
+		avx2_field(base, 12, 10, out->gyro_z + i);
+	}
+
+	return n;
+}
+
+#endif
+
+#ifdef __SSE2__
+
+static inline void sse2_field(const unsigned char *base, int offset,
+			      int shift, float *out)
+{
+	const unsigned char *p = base + offset;
+	__m128i v = _mm_setr_epi32(load_be32(p), load_be32(p + 16),
+				   load_be32(p + TRACKER_REPORT_SIZE),
+				   load_be32(p + TRACKER_REPORT_SIZE + 16));
+
+	v = _mm_srai_epi32(_mm_sll_epi32(v, _mm_cvtsi32_si128(shift)), 11);
+	_mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(v),
+				      _mm_set1_ps(RIFT_SCALE)));
+}
+
+// 2 reports, 4 slots at a time
+static int decode_batch_sse2(const unsigned char *reports, int count,
+			     const tracker_samples_soa * out)
+{
+	int n = count & ~1;
+
+	for (int r = 0; r < n; r += 2) {
+		const unsigned char *base = reports + r * TRACKER_REPORT_SIZE +
+		    TRACKER_SAMPLE_OFFSET;
+		int i = r * TRACKER_REPORT_SLOTS;
+
+		sse2_field(base, 0, 0, out->accel_x + i);
+		sse2_field(base, 2, 5, out->accel_y + i);
+		sse2_field(base, 4, 10, out->accel_z + i);
+		sse2_field(base, 8, 0, out->gyro_x + i);
+		sse2_field(base, 10, 5, out->gyro_y + i);
+		sse2_field(base, 12, 10, out->gyro_z + i);
+	}
+
+	return n;
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+static inline void neon_field(const unsigned char *base, int offset,
+			      int shift, float *out)
+{
+	const unsigned char *p = base + offset;
+	int32_t w[4] = { load_be32(p), load_be32(p + 16),
+		load_be32(p + TRACKER_REPORT_SIZE),
+		load_be32(p + TRACKER_REPORT_SIZE + 16)
+	};
+
+	int32x4_t v = vshlq_s32(vld1q_s32(w), vdupq_n_s32(shift));
+	v = vshrq_n_s32(v, 11);
+	vst1q_f32(out, vmulq_n_f32(vcvtq_f32_s32(v), RIFT_SCALE));
+}
+
+// 2 reports, 4 slots at a time
+static int decode_batch_neon(const unsigned char *reports, int count,
+			     const tracker_samples_soa * out)
+{
+	int n = count & ~1;
+
+	for (int r = 0; r < n; r += 2) {
+		const unsigned char *base = reports + r * TRACKER_REPORT_SIZE +
+		    TRACKER_SAMPLE_OFFSET;
+		int i = r * TRACKER_REPORT_SLOTS;
+
+		neon_field(base, 0, 0, out->accel_x + i);
+		neon_field(base, 2, 5, out->accel_y + i);
+		neon_field(base, 4, 10, out->accel_z + i);
+		neon_field(base, 8, 0, out->gyro_x + i);
+		neon_field(base, 10, 5, out->gyro_y + i);
+		neon_field(base, 12, 10, out->gyro_z + i);
+	}
+
+	return n;
+}
+
+#endif
+
+void decode_tracker_samples_batch(const unsigned char *reports, int count,
+				  const tracker_samples_soa * out)
+{
+	int done = 0;
+
+#if defined(HAVE_AVX2_DISPATCH)
+	if (__builtin_cpu_supports("avx2")) {
+		done = decode_batch_avx2(reports, count, out);
+	}
+#endif
+#if defined(__SSE2__)
+	if (!done) {
+		done = decode_batch_sse2(reports, count, out);
+	}
+#elif defined(__ARM_NEON)
+	done = decode_batch_neon(reports, count, out);
+#endif
+
+	// whatever the vector loop left over
+	decode_batch_scalar(reports, done, count, out);
+}
+
+const char *decode_batch_impl()
+{
+#if defined(HAVE_AVX2_DISPATCH)
+	if (__builtin_cpu_supports("avx2")) {
+		return "avx2";
+	}
+#endif
+#if defined(__SSE2__)
+	return "sse2";
+#elif defined(__ARM_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+/*
+ * The vendor driver turns the firmware quaternion, with y and z negated, by
+ * the mount rotation of 90 degrees about x, calling sinf() and cosf() of 45
+ * degrees on every report. With both equal to sqrt(1/2) the product is
+ * sqrt(1/2) (w + x, z - y, -y - z, w - x); __PAIR64__(hi, lo) there puts
+ * v18 in z and v17 in w. The common factor and the 2^-14 scale go away
+ * when normalizing, which leaves two shuffles, two sign flips and an add.
+ */
+
+#if defined(__SSE2__)
+
+static void fw_quat_sse2(const int16_t * q, quatf * out)
+{
+	__m128i v = _mm_loadl_epi64((const __m128i *)q);
+	__m128 f = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+
+	// (w, z, -y, w) + (x, -y, -z, -x)
+	__m128 a = _mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 1, 2, 3));
+	__m128 b = _mm_shuffle_ps(f, f, _MM_SHUFFLE(0, 2, 1, 0));
+	a = _mm_xor_ps(a, _mm_setr_ps(0.0f, 0.0f, -0.0f, 0.0f));
+	b = _mm_xor_ps(b, _mm_setr_ps(0.0f, -0.0f, -0.0f, -0.0f));
+	__m128 r = _mm_add_ps(a, b);
+
+	__m128 n = _mm_mul_ps(r, r);
+	n = _mm_add_ps(n, _mm_shuffle_ps(n, n, _MM_SHUFFLE(2, 3, 0, 1)));
+	n = _mm_add_ps(n, _mm_shuffle_ps(n, n, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	if (_mm_cvtss_f32(n) == 0) {
+		*out = (quatf) { {0, 0, 0, 1} };
+		return;
+	}
+
+	_mm_storeu_ps(out->arr, _mm_div_ps(r, _mm_sqrt_ps(n)));
+}
+
+#elif defined(__ARM_NEON)
+
+static void fw_quat_neon(const int16_t * q, quatf * out)
+{
+	float32x4_t f = vcvtq_f32_s32(vmovl_s16(vld1_s16(q)));
+	float32x4_t a = { vgetq_lane_f32(f, 3), vgetq_lane_f32(f, 2),
+		-vgetq_lane_f32(f, 1), vgetq_lane_f32(f, 3)
+	};
+	float32x4_t b = { vgetq_lane_f32(f, 0), -vgetq_lane_f32(f, 1),
+		-vgetq_lane_f32(f, 2), -vgetq_lane_f32(f, 0)
+	};
+	float32x4_t r = vaddq_f32(a, b);
+	float32x4_t n = vmulq_f32(r, r);
+	float32x2_t s = vadd_f32(vget_low_f32(n), vget_high_f32(n));
+	float len = vget_lane_f32(vpadd_f32(s, s), 0);
+
+	if (len == 0) {
+		*out = (quatf) { {0, 0, 0, 1} };
+		return;
+	}
+
+	vst1q_f32(out->arr, vmulq_n_f32(r, 1.0f / sqrtf(len)));
+}
+
+#else
+
+static void fw_quat_scalar(const int16_t * q, quatf * out)
+{
+	float x = q[0], y = q[1], z = q[2], w = q[3];
+	quatf r = { {w + x, z - y, -y - z, w - x} };
+	float n = r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w;
+
+	if (n == 0) {
+		*out = (quatf) { {0, 0, 0, 1} };
+		return;
+	}
+
+	n = 1.0f / sqrtf(n);
+	for (int i = 0; i < 4; i++) {
+		out->arr[i] = r.arr[i] * n;
+	}
+}
+
+#endif
+
+void decode_fw_quat(const unsigned char *buffer, quatf * out)
+{
+	int16_t q[4];
+
+	memcpy(q, buffer, sizeof(q));
+
+#if defined(__SSE2__)
+	fw_quat_sse2(q, out);
+#elif defined(__ARM_NEON)
+	fw_quat_neon(q, out);
+#else
+	fw_quat_scalar(q, out);
+#endif
+}
@@ -0,0 +1,39 @@
+/* Decoding of the packed IMU samples in tracker reports */
+
+#ifndef __HMD_DECODE__
+#define __HMD_DECODE__
+
+#include <stdint.h>
+
+#include "omath.h"
+
+#define TRACKER_REPORT_SIZE 64
+#define TRACKER_REPORT_SLOTS 2	// sample slots in a DK2 style report
+#define TRACKER_SAMPLE_OFFSET 12
+
+typedef struct {
+	float *accel_x, *accel_y, *accel_z;
+	float *gyro_x, *gyro_y, *gyro_z;
+} tracker_samples_soa;
+
+void decode_sample(const unsigned char *buffer, int32_t * smp);
+void vec3f_from_rift_vec(const int32_t * smp, vec3f * out_vec);
+
+/* Decode both sample slots of count DK2 tracker reports stored back to back
+   every TRACKER_REPORT_SIZE bytes. Slot j of report i lands at index
+   i * TRACKER_REPORT_SLOTS + j of every array; a slot past num_samples holds
+   whatever the device left there. Results are bit-exact with
+   decode_sample() followed by vec3f_from_rift_vec(). */
+void decode_tracker_samples_batch(const unsigned char *reports, int count,
+				  const tracker_samples_soa * out);
+
+/* Name of the implementation decode_tracker_samples_batch() picked */
+const char *decode_batch_impl();
+
+/* The orientation the firmware fuses itself: four int16 at buffer, x y z w
+   in units of 2^-14, with y and z negated and turned by the 90 degree
+   mount rotation about x of the vendor driver (hid_read.ida.c), then
+   normalized. All zero reads as identity. */
+void decode_fw_quat(const unsigned char *buffer, quatf * out);
+
+#endif
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "devclock.h"
+#include "log.h"
+
+#define PERIOD_WEIGHT 0.01	// of each new sample period estimate
+#define MAX_PERIOD_ERROR 0.5	// reports further off than this hold a gap
+#define MAX_RESIDUAL 0.02	// s, arrivals further off the fit are outliers
+
+void devclock_init(hmd_devclock * c, double nominal_period)
+{
+	memset(c, 0, sizeof(hmd_devclock));
+	c->scale = 1.0;
+	c->period = nominal_period;
+}
+
+static void fit(hmd_devclock * c)
+{
+	double mx = 0, my = 0, sxx = 0, sxy = 0;
+
+	for (int i = 0; i < c->count; i++) {
+		mx += c->dev[i];
+		my += c->host[i];
+	}
+	mx /= c->count;
+	my /= c->count;
+
+	for (int i = 0; i < c->count; i++) {
+		double dx = c->dev[i] - mx;
+		sxx += dx * dx;
+		sxy += dx * (c->host[i] - my);
+	}
+
+	if (sxx <= 0) {
+		return;
+	}
+
+	c->scale = sxy / sxx;
+	c->offset = my - c->scale * mx;
+	c->fitted = 1;
+}
+
+static void restart(hmd_devclock * c, double host_time)
+{
+	c->origin = c->last;
+	c->host_origin = host_time;
+	c->count = c->pos = c->since_fit = 0;
+	c->outliers = 0;
+	c->offset = 0;
+	c->scale = 1.0;
+	c->fitted = 0;
+}
+
+uint64_t devclock_update(hmd_devclock * c, uint32_t raw, uint64_t wrap,
+			 int num_samples, double host_time)
+{
+	if (!c->started) {
+		c->started = 1;
+		c->last_raw = raw;
+		c->last = raw;
+		restart(c, host_time);
+	} else {
+		uint64_t delta = ((uint64_t)raw + wrap - c->last_raw) % wrap;
+
+		c->last_raw = raw;
+
+		// anything over half the range is the device going back; keep
+		// the unwrapped time monotonic and start the fit over
+		if (delta > wrap / 2) {
+			LOGW("device clock went back, restarting the clock model");
+			c->resets++;
+			restart(c, host_time);
+		} else {
+			c->last += delta;
+
+			// one sample period per sample since the last report,
+			// unless reports went missing in between
+			if (delta && num_samples > 0) {
+				double p = delta * 1e-6 / num_samples;
+				if (p < c->period * (1 + MAX_PERIOD_ERROR)
+				    && p > c->period * (1 - MAX_PERIOD_ERROR)) {
+					c->period += (p - c->period) *
+					    PERIOD_WEIGHT;
+				}
+			}
+		}
+	}
+
+	// stale reports queued up before we started reading, or reads stalled
+	// on the host, are far off the line; keep them out of the fit unless
+	// there are enough of them in a row that the line must be wrong
+	double residual = host_time - devclock_host_time(c, c->last);
+	if (residual > MAX_RESIDUAL || residual < -MAX_RESIDUAL) {
+		if (++c->outliers < DEVCLOCK_MIN_FIT) {
+			return c->last;
+		}
+		c->resets++;
+		restart(c, host_time);
+	}
+	c->outliers = 0;
+
+	c->dev[c->pos] = (c->last - c->origin) * 1e-6;
+	c->host[c->pos] = host_time - c->host_origin;
+	c->pos = (c->pos + 1) % DEVCLOCK_WINDOW;
+	if (c->count < DEVCLOCK_WINDOW) {
+		c->count++;
+	}
+
+	if (c->count >= DEVCLOCK_MIN_FIT && ++c->since_fit >= DEVCLOCK_REFIT) {
+		c->since_fit = 0;
+		fit(c);
+	} else if (!c->fitted) {
+		// until there is a fit, trust the latest report
+		c->offset = host_time - c->host_origin -
+		    (c->last - c->origin) * 1e-6;
+	}
+
+	return c->last;
+}
+
+double devclock_host_time(const hmd_devclock * c, uint64_t device)
+{
+	double dev = ((double)device - (double)c->origin) * 1e-6;
+	return c->host_origin + c->offset + c->scale * dev;
+}
+
+double devclock_drift_ppm(const hmd_devclock * c)
+{
+	return (c->scale - 1.0) * 1e6;
+}
@@ -0,0 +1,52 @@
+/* Device clock model: unwraps the tracker's timestamp counter and fits
+   host time against it over a sliding window, so every IMU sample gets a
+   CLOCK_MONOTONIC timestamp and the real sample period is known. */
+
+#ifndef __HMD_DEVCLOCK__
+#define __HMD_DEVCLOCK__
+
+#include <stdint.h>
+
+#define DEVCLOCK_WINDOW 256	// reports the fit covers
+#define DEVCLOCK_REFIT 32	// reports between fits
+#define DEVCLOCK_MIN_FIT 16	// reports before the first fit
+
+// counter moduli in us: DK1 counts 16 bit milliseconds, DK2 32 bit micros
+#define DEVCLOCK_WRAP_DK1 (65536ULL * 1000)
+#define DEVCLOCK_WRAP_DK2 (1ULL << 32)
+
+typedef struct {
+	int started;
+	uint32_t last_raw;
+	uint64_t last;		// unwrapped device time of the last report, us
+	uint64_t origin;	// unwrapped device time window times are from
+	double host_origin;
+
+	// (device, host) seconds since the origins, oldest at pos once full
+	double dev[DEVCLOCK_WINDOW], host[DEVCLOCK_WINDOW];
+	int count, pos, since_fit;
+	int outliers;		// reports in a row too far off the fit
+
+	// host = host_origin + offset + scale * (device - origin)
+	double offset, scale;
+	int fitted;
+
+	double period;		// sample period, s
+	uint64_t resets;	// times the model had to start over
+} hmd_devclock;
+
+void devclock_init(hmd_devclock * c, double nominal_period);
+
+/* Feed the raw timestamp of a report holding num_samples samples, the last
+   one taken at raw, and the host tick the report arrived at. Returns the
+   unwrapped device time in us, which never goes backwards. */
+uint64_t devclock_update(hmd_devclock * c, uint32_t raw, uint64_t wrap,
+			 int num_samples, double host_time);
+
+/* Host tick an unwrapped device time corresponds to */
+double devclock_host_time(const hmd_devclock * c, uint64_t device);
+
+/* Device clock rate error against the host in parts per million */
+double devclock_drift_ppm(const hmd_devclock * c);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Mahony style complementary filter: the gyro is integrated every sample
+ * and the accelerometer, while it measures little more than gravity, pulls
+ * the estimated up vector back with proportional and integral feedback.
+ * A calibrated magnetometer does the same for the heading, which gravity
+ * says nothing about. The integral term absorbs the gyro bias.
+ */
+
+#include <string.h>
+
+#include "fusion.h"
+
+#define GRAVITY_EARTH 9.82f
+
+#define FUSION_KP 0.5f
+#define FUSION_KI 0.05f
+#define FUSION_KMAG 0.2f	// weight of the heading error against tilt
+
+// a field this close to vertical says nothing about the heading
+#define FUSION_MAG_MIN 0.2f
+
+// converge quickly from the initial identity orientation
+#define FUSION_SETTLE_SAMPLES 500
+#define FUSION_SETTLE_KP 10.0f
+
+// ignore the accelerometer while it measures far more than gravity
+#define FUSION_ACCEL_MIN (0.5f * GRAVITY_EARTH)
+#define FUSION_ACCEL_MAX (1.5f * GRAVITY_EARTH)
+
+void ofusion_init(fusion * me)
+{
+	memset(me, 0, sizeof(fusion));
+	me->orient.w = 1.0f;
+	me->kp = FUSION_KP;
+	me->ki = FUSION_KI;
+	me->kmag = FUSION_KMAG;
+}
+
+void ofusion_update(fusion * me, float dt, const vec3f * ang_vel,
+		    const vec3f * accel, const vec3f * mag)
+{
+	quatf *q = &me->orient;
+	vec3f w = *ang_vel;
+	vec3f bias_free = *ang_vel;
+	vec3f e = { {0, 0, 0} };
+	float a_len = ovec3f_get_length(accel);
+
+	// world up seen from the sensor, the second row of the rotation
+	// matrix of q
+	vec3f up = { {2.0f * (q->x * q->y + q->w * q->z),
+		      1.0f - 2.0f * (q->x * q->x + q->z * q->z),
+		      2.0f * (q->y * q->z - q->w * q->x)} };
+
+	if (a_len > FUSION_ACCEL_MIN && a_len < FUSION_ACCEL_MAX) {
+		vec3f a = { {accel->x / a_len, accel->y / a_len,
+			     accel->z / a_len} };
+
+		ovec3f_cross(&a, &up, &e);
+	}
+
+	// heading: turn about world up until the horizontal field points
+	// where it did once the filter had settled
+	if (mag && me->iterations >= FUSION_SETTLE_SAMPLES) {
+		vec3f m;
+		oquatf_get_rotated(q, mag, &m);
+		m.y = 0;
+
+		float m_len = ovec3f_get_length(&m);
+		if (m_len > FUSION_MAG_MIN) {
+			m.x /= m_len;
+			m.z /= m_len;
+			if (!me->have_mag_ref) {
+				me->mag_ref = m;
+				me->have_mag_ref = 1;
+			}
+
+			float yaw = m.z * me->mag_ref.x - m.x * me->mag_ref.z;
+			for (int i = 0; i < 3; i++) {
+				e.arr[i] += me->kmag * yaw * up.arr[i];
+			}
+		}
+	}
+
+	float kp = me->iterations < FUSION_SETTLE_SAMPLES ?
+	    FUSION_SETTLE_KP : me->kp;
+
+	for (int i = 0; i < 3; i++) {
+		me->integral.arr[i] += me->ki * e.arr[i] * dt;
+		bias_free.arr[i] += me->integral.arr[i];
+		w.arr[i] += kp * e.arr[i] + me->integral.arr[i];
+	}
+
+	// q += 0.5 * q * (w, 0) * dt
+	float hx = 0.5f * w.x * dt, hy = 0.5f * w.y * dt, hz = 0.5f * w.z * dt;
+	quatf r = { {q->x + q->w * hx + q->y * hz - q->z * hy,
+		     q->y + q->w * hy - q->x * hz + q->z * hx,
+		     q->z + q->w * hz + q->x * hy - q->y * hx,
+		     q->w - q->x * hx - q->y * hy - q->z * hz} };
+
+	oquatf_normalize_me(&r);
+	*q = r;
+
+	me->ang_vel = bias_free;
+	me->iterations++;
+}
@@ -0,0 +1,29 @@
+/* Host side orientation filter, replacing OpenHMD's ofusion */
+
+#ifndef __HMD_FUSION__
+#define __HMD_FUSION__
+
+#include <stdint.h>
+
+#include "omath.h"
+
+typedef struct {
+	quatf orient;		// sensor to world, world is Y up
+	vec3f ang_vel;		// angular velocity with the estimated bias removed
+	vec3f integral;		// integral feedback, the negated gyro bias
+	float kp, ki;		// accelerometer correction gains
+	float kmag;		// magnetometer weight against the accelerometer
+	vec3f mag_ref;		// horizontal world field, the heading to hold
+	int have_mag_ref;
+	uint32_t iterations;
+} fusion;
+
+void ofusion_init(fusion * me);
+
+/* Feed one IMU sample: dt in s, angular velocity in rad/s, acceleration in
+   m/s^2. mag, the calibrated field at unit length, holds the heading; NULL
+   while there is no calibration to trust. */
+void ofusion_update(fusion * me, float dt, const vec3f * ang_vel,
+		    const vec3f * accel, const vec3f * mag);
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "packet.h"
+#include "decode.h"
+
+/*
+ * libFuzzer target for the report decoders in packet.h: each decoder must
+ * accept exactly the inputs long enough for its layout without reading
+ * past them, the sensor config must survive a decode/encode round trip and
+ * the firmware quaternion must come out unit length.
+ */
+
+#define MAX_INPUT 256		// the largest feature report
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+	pkt_sensor_range range;
+	pkt_sensor_config config;
+	pkt_sensor_display_info display;
+	pkt_tracker_sensor sensor;
+	pkt_fw_quat fw;
+	quatf q;
+	unsigned char out[PKT_SENSOR_CONFIG_SIZE];
+	int len = size < MAX_INPUT ? (int)size : MAX_INPUT;
+
+	// a heap copy of exactly len bytes lets ASan catch overreads
+	unsigned char *input = malloc(len ? len : 1);
+	memcpy(input, data, len);
+
+	if (pkt_sensor_range_decode(&range, input, len) !=
+	    (len >= PKT_SENSOR_RANGE_SIZE)
+	    || pkt_display_info_decode(&display, input, len) !=
+	    (len >= PKT_DISPLAY_INFO_SIZE)
+	    || pkt_tracker_dk1_decode(&sensor, input, len) !=
+	    (len >= PKT_TRACKER_DK1_SIZE)
+	    || pkt_tracker_dk2_decode(&sensor, input, len) !=
+	    (len >= PKT_TRACKER_DK2_SIZE)
+	    || pkt_fw_quat_decode(&fw, input, len) !=
+	    (len >= PKT_FW_QUAT_SIZE)) {
+		abort();
+	}
+
+	if (len >= PKT_FW_QUAT_SIZE) {
+		decode_fw_quat(input + PKT_FW_QUAT_OFFSET, &q);
+		float n = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
+		if (n < 0.999f || n > 1.001f) {
+			abort();
+		}
+	}
+
+	if (pkt_sensor_config_decode(&config, input, len)) {
+		pkt_sensor_config_encode(&config, out);
+		if (memcmp(out + 1, input + 1, PKT_SENSOR_CONFIG_SIZE - 1)) {
+			abort();
+		}
+	} else if (len >= PKT_SENSOR_CONFIG_SIZE) {
+		abort();
+	}
+
+	free(input);
+
+	return 0;
+}
@@ -1,65 +1,60 @@
+#define _GNU_SOURCE		// pthread_setaffinity_np()
+
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
 #include <time.h>
-#include <hidapi.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
 #include "hid.h"
+#include "decode.h"
+#include "cache.h"
+#include "backend.h"
+#include "devclock.h"
+#include "shm.h"
+#include "rec.h"
+#include "log.h"
+#include "trace.h"
 
-#define MAX_STR 1024
 
 #define FEATURE_BUFFER_SIZE 256
 
-#define TICK_LEN (1.0f / 1000.0f)	// 1000 Hz ticks
+#define TICK_LEN (1.0f / 1000.0f)	// nominal 1000 Hz, refined by the clock model
 #define KEEP_ALIVE_VALUE (10 * 1000)
+#define KEEP_ALIVE_DEFAULT_MS 1000	// until the device says otherwise
+#define KEEP_ALIVE_MIN_PERIOD 0.05
+#define READER_TIMEOUT_MS 100	// how often a blocked reader checks for stop
+#define HEALTH_WINDOW 1.0	// s
+#define RT_STACK_PREFAULT (256 * 1024)	// bytes of reader stack touched
 #define SETFLAG(_s, _flag, _val) (_s) = ((_s) & ~(_flag)) | ((_val) ? (_flag) : 0)
 
-#define SKIP_CMD (buffer++)
-#define READ8 *(buffer++);
-#define READ16 *buffer | (*(buffer + 1) << 8); buffer += 2;
-#define READ32 *buffer | (*(buffer + 1) << 8) | (*(buffer + 2) << 16) | (*(buffer + 3) << 24); buffer += 4;
-#define READFLOAT ((float)(*buffer)); buffer += 4;
-#define READFIXED (float)(*buffer | (*(buffer + 1) << 8) | (*(buffer + 2) << 16) | (*(buffer + 3) << 24)) / 1000000.0f; buffer += 4;
-
-#define WRITE8(_val) *(buffer++) = (_val);
-#define WRITE16(_val) WRITE8((_val) & 0xff); WRITE8(((_val) >> 8) & 0xff);
-#define WRITE32(_val) WRITE16((_val) & 0xffff) *buffer; WRITE16(((_val) >> 16) & 0xffff);
-
 #define OHMD_MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
 #define OHMD_MIN(_a, _b) ((_a) < (_b) ? (_a) : (_b))
-
-#define LOGD LOGI
-#define LOGW LOGI
-#define LOGE LOGI
-
-static void LOGI(const char *fmt, ...)
-{
-	char message[2048];
-	va_list ap;
-
-	va_start(ap, fmt);
-	//vsyslog( pri, fmt, ap );
-
-	vsnprintf(message, sizeof(message), fmt, ap);
-
-	va_end(ap);
-
-	fprintf(stderr, "syslog: %s\n", message);
-}
+#define OHMD_ARRAY_SIZE(_a) ((int)(sizeof(_a) / sizeof((_a)[0])))
 
 static void DUMP(unsigned char *buffer, int size)
 {
-	fprintf(stderr, "DUMP %d bytes:\n", size);
+	char text[FEATURE_BUFFER_SIZE * 3 + FEATURE_BUFFER_SIZE / 16 + 1];
+	int n = 0;
 
+	size = OHMD_MIN(size, FEATURE_BUFFER_SIZE);
 	for (int i = 0; i < size; i++) {
-		fprintf(stderr, "%02X ", buffer[i]);
-		if (i % 16 == 15) {
-			fprintf(stderr, "\n");
-		}
+		n += sprintf(text + n, i % 16 == 15 && i + 1 < size ?
+			     "%02X\n" : "%02X ", buffer[i]);
 	}
-	fprintf(stderr, "\n");
+	text[n] = 0;
+
+	LOGI("DUMP %d bytes:\n%s", size, text);
 }
 
 static int get_feature_report(HMDHidInfo * info, char cmd, unsigned char *buf);
@@ -69,64 +64,38 @@ static int send_feature_report(HMDHidInfo * info, const unsigned char *data,
 static int decode_sensor_range(pkt_sensor_range * range,
 			       const unsigned char *buffer, int size)
 {
-	if (!(size == 8 || size == 9)) {
-		LOGE("invalid packet size (expected 8 or 9 but got %d)", size);
+	if (!pkt_sensor_range_decode(range, buffer, size)) {
+		LOGE("invalid packet size (expected %d or more but got %d)",
+		     PKT_SENSOR_RANGE_SIZE, size);
 		return 0;
 	}
 
-	SKIP_CMD;
-	range->command_id = READ16;
-	range->accel_scale = READ8;
-	range->gyro_scale = READ16;
-	range->mag_scale = READ16;
-
 	return 1;
 }
 
 static int decode_sensor_display_info(pkt_sensor_display_info * info,
 				      const unsigned char *buffer, int size)
 {
-	if (!(size == 56 || size == 57)) {
-		LOGE("invalid packet size (expected 56 or 57 but got %d)",
-		     size);
+	if (!pkt_display_info_decode(info, buffer, size)) {
+		LOGE("invalid packet size (expected %d or more but got %d)",
+		     PKT_DISPLAY_INFO_SIZE, size);
 		return 0;
 	}
 
-	SKIP_CMD;
-	info->command_id = READ16;
-	info->distortion_type = READ8;
-	info->h_resolution = READ16;
-	info->v_resolution = READ16;
-	info->h_screen_size = READFIXED;
-	info->v_screen_size = READFIXED;
-	info->v_center = READFIXED;
-	info->lens_separation = READFIXED;
-	info->eye_to_screen_distance[0] = READFIXED;
-	info->eye_to_screen_distance[1] = READFIXED;
-
 	info->distortion_type_opts = 0;
 
-	for (int i = 0; i < 6; i++) {
-		info->distortion_k[i] = READFLOAT;
-	}
-
 	return 1;
 }
 
 static int decode_sensor_config(pkt_sensor_config * config,
 				const unsigned char *buffer, int size)
 {
-	if (!(size == 7 || size == 8)) {
-		LOGE("invalid packet size (expected 7 or 8 but got %d)", size);
+	if (!pkt_sensor_config_decode(config, buffer, size)) {
+		LOGE("invalid packet size (expected %d or more but got %d)",
+		     PKT_SENSOR_CONFIG_SIZE, size);
 		return 0;
 	}
 
-	SKIP_CMD;
-	config->command_id = READ16;
-	config->flags = READ8;
-	config->packet_interval = READ8;
-	config->keep_alive_interval = READ16;
-
 	return 1;
 }
 
@@ -211,44 +180,34 @@ void dump_packet_tracker_sensor(const pkt_tracker_sensor * sensor)
 static int encode_sensor_config(unsigned char *buffer,
 				const pkt_sensor_config * config)
 {
-	WRITE8(RIFT_CMD_SENSOR_CONFIG);
-	WRITE16(config->command_id);
-	WRITE8(config->flags);
-	WRITE8(config->packet_interval);
-	WRITE16(config->keep_alive_interval);
-	return 7;		// sensor config packet size
+	return pkt_sensor_config_encode(config, buffer);
 }
 
 static int encode_pimax_cmd_2(unsigned char *buffer)
 {
-	WRITE8(0x02);
-	WRITE8(0x00);
-	WRITE8(0x00);
-	WRITE8(0x20);
-	WRITE8(0x01);
-	WRITE8(0xe8);
-	WRITE8(0x03);
-	return 7;
+	const pkt_sensor_config config = {
+		.flags = RIFT_SCF_COMMAND_KEEP_ALIVE,
+		.packet_interval = 1,
+		.keep_alive_interval = KEEP_ALIVE_DEFAULT_MS
+	};
+
+	return pkt_sensor_config_encode(&config, buffer);
 }
 
 static int encode_pimax_cmd_17(unsigned char *buffer)
 {
-	WRITE8(0x11);
-	WRITE8(0x00);
-	WRITE8(0x00);
-	WRITE8(0x0b);
-	WRITE8(0x10);
-	WRITE8(0x27);
-	return 6;
+	const pkt_pimax_keep_alive keep_alive = {
+		.report = RIFT_IRQ_SENSORS_DK2,
+		.keep_alive_interval = KEEP_ALIVE_VALUE
+	};
+
+	return pkt_pimax_keep_alive_encode(&keep_alive, buffer);
 }
 
 static int encode_keep_alive(unsigned char *buffer,
 			     const pkt_keep_alive * keep_alive)
 {
-	WRITE8(RIFT_CMD_KEEP_ALIVE);
-	WRITE16(keep_alive->command_id);
-	WRITE16(keep_alive->keep_alive_interval);
-	return 5;		// keep alive packet size
+	return pkt_keep_alive_encode(keep_alive, buffer);
 }
 
 static void set_coordinate_frame(HMDHidInfo * info,
@@ -288,57 +247,17 @@ static void set_coordinate_frame(HMDHidInfo * info,
 	}
 }
 
-static void decode_sample(const unsigned char *buffer, int32_t * smp)
-{
-	/*
-	 * Decode 3 tightly packed 21 bit values from 4 bytes.
-	 * We unpack them in the higher 21 bit values first and then shift
-	 * them down to the lower in order to get the sign bits correct.
-	 */
-
-	int x =
-	    (buffer[0] << 24) | (buffer[1] << 16) | ((buffer[2] & 0xF8) << 8);
-	int y =
-	    ((buffer[2] & 0x07) << 29) | (buffer[3] << 21) | (buffer[4] << 13) |
-	    ((buffer[5] & 0xC0) << 5);
-	int z =
-	    ((buffer[5] & 0x3F) << 26) | (buffer[6] << 18) | (buffer[7] << 10);
-
-	smp[0] = x >> 11;
-	smp[1] = y >> 11;
-	smp[2] = z >> 11;
-}
-
 static int decode_tracker_sensor_msg(pkt_tracker_sensor * msg,
 				     const unsigned char *buffer, int size)
 {
-	if (!(size == 62 || size == 64)) {
-		LOGE("invalid packet size (expected 62 or 64 but got %d)",
-		     size);
+	if (!pkt_tracker_dk1_decode(msg, buffer, size)) {
+		LOGE("invalid packet size (expected %d or more but got %d)",
+		     PKT_TRACKER_DK1_SIZE, size);
 		return 0;
 	}
 
-	SKIP_CMD;
-	msg->num_samples = READ8;
-	msg->timestamp = READ16;
 	msg->timestamp *= 1000;	// DK1 timestamps are in milliseconds
-	msg->last_command_id = READ16;
-	msg->temperature = READ16;
-
 	msg->num_samples = OHMD_MIN(msg->num_samples, 3);
-	for (int i = 0; i < msg->num_samples; i++) {
-		decode_sample(buffer, msg->samples[i].accel);
-		buffer += 8;
-
-		decode_sample(buffer, msg->samples[i].gyro);
-		buffer += 8;
-	}
-
-	// Skip empty samples
-	buffer += (3 - msg->num_samples) * 16;
-	for (int i = 0; i < 3; i++) {
-		msg->mag[i] = READ16;
-	}
 
 	return 1;
 }
@@ -346,64 +265,67 @@ static int decode_tracker_sensor_msg(pkt_tracker_sensor * msg,
 static int decode_tracker_sensor_msg_dk2(pkt_tracker_sensor * msg,
 					 const unsigned char *buffer, int size)
 {
-	if (!(size == 64)) {
-		LOGE("invalid packet size (expected 62 or 64 but got %d)",
-		     size);
+	if (!pkt_tracker_dk2_decode(msg, buffer, size)) {
+		LOGE("invalid packet size (expected %d or more but got %d)",
+		     PKT_TRACKER_DK2_SIZE, size);
 		return 0;
 	}
 
-	SKIP_CMD;
-	msg->last_command_id = READ16;
-	msg->num_samples = READ8;
-	/* Next is the number of samples since start, excluding the samples
-	   contained in this packet */
-	buffer += 2;		// unused: nb_samples_since_start
-	msg->temperature = READ16;
-	msg->timestamp = READ32;
-	LOGI("timestamp %08X", msg->timestamp);
-	/* Second sample value is junk (outdated/uninitialized) value if
-	   num_samples < 2. */
-	LOGI("samples %02X", msg->num_samples);
+	TRACE(TRACE_SENSOR, msg->timestamp, msg->num_samples);
 	msg->num_samples = OHMD_MIN(msg->num_samples, 2);
-	for (int i = 0; i < msg->num_samples; i++) {
-		decode_sample(buffer, msg->samples[i].accel);
-		buffer += 8;
-
-		decode_sample(buffer, msg->samples[i].gyro);
-		buffer += 8;
-	}
-
-	// Skip empty samples
-	buffer += (2 - msg->num_samples) * 16;
-
-	for (int i = 0; i < 3; i++) {
-		msg->mag[i] = READ16;
-	}
 
 	// TODO: positional tracking data and frame data
 
 	return 1;
 }
 
-// TODO do we need to consider HMD vs sensor "centric" values
-static void vec3f_from_rift_vec(const int32_t * smp, vec3f * out_vec)
+static void profile_mark(HMDHidInfo * info, HMDHidStage stage)
 {
-	out_vec->x = (float)smp[0] * 0.0001f;
-	out_vec->y = (float)smp[1] * 0.0001f;
-	out_vec->z = (float)smp[2] * 0.0001f;
+	double now = HID_get_tick();
+
+	hist_record(&info->profile->stage[stage], now - info->profile->mark);
+	info->profile->mark = now;
+}
+
+#define RESAMPLE_MAX_GAP 1.0	// s, start the grid over after longer gaps
+
+/* Keep every orientation for HID_GetPoseAt() and put out the resampled
+   ones the new sample completes */
+static void record_sample(HMDHidInfo * info, double time, const quatf * orient,
+			  const vec3f * ang_vel)
+{
+	history_push(&info->history, time, orient, ang_vel);
+
+	double period = info->resample_period;
+	if (period <= 0) {
+		return;
+	}
+
+	if (!info->next_resample
+	    || time - info->next_resample > RESAMPLE_MAX_GAP) {
+		info->next_resample = ceil(time / period) * period;
+	}
+
+	while (info->next_resample <= time) {
+		hmd_pose_sample s;
+		if (history_at(&info->history, info->next_resample, &s) >= 0) {
+			history_push(&info->resampled, s.time, &s.orient,
+				     &s.ang_vel);
+		}
+		info->next_resample += period;
+	}
 }
 
 static void handle_tracker_sensor_msg(HMDHidInfo * info, unsigned char *buffer,
 				      int size)
 {
-	if (buffer[0] == RIFT_IRQ_SENSORS
-	    && !decode_tracker_sensor_msg(&info->sensor, buffer, size)) {
-		LOGE("couldn't decode tracker sensor message");
-	}
+	int dk2 = buffer[0] == RIFT_IRQ_SENSORS_DK2;
 
-	if (buffer[0] == RIFT_IRQ_SENSORS_DK2
-	    && !decode_tracker_sensor_msg_dk2(&info->sensor, buffer, size)) {
+	if (!(dk2 ? decode_tracker_sensor_msg_dk2(&info->sensor, buffer, size) :
+	      decode_tracker_sensor_msg(&info->sensor, buffer, size))) {
 		LOGE("couldn't decode tracker sensor message");
+		info->health.decode_errors++;
+		return;
 	}
 
 	pkt_tracker_sensor *s = &info->sensor;
@@ -413,277 +335,1275 @@ static void handle_tracker_sensor_msg(HMDHidInfo * info, unsigned char *buffer,
 	int32_t mag32[] = { s->mag[0], s->mag[1], s->mag[2] };
 	vec3f_from_rift_vec(mag32, &info->raw_mag);
 
-	// TODO: handle overflows in a nicer way
-	float dt = TICK_LEN;	// TODO: query the Rift for the sample rate
-	if (s->timestamp > info->last_imu_timestamp) {
-		dt = (s->timestamp - info->last_imu_timestamp) / 1000000.0f;
-		dt -= (s->num_samples - 1) * TICK_LEN;	// TODO: query the Rift for the sample rate
+	vec3f mag;
+	int have_mag = magcal_update(&info->magcal, &info->raw_mag, &mag);
+
+	if (info->profile) {
+		profile_mark(info, HID_STAGE_DECODE);
 	}
 
-	for (int i = 0; i < s->num_samples; i++) {
+	hmd_devclock *clock = &info->clock;
+	int had_clock = clock->started;
+	uint64_t resets = clock->resets;
+	uint64_t last = clock->last;
+
+	// the DK2 counts the samples it takes: slots older than the count
+	// since the last report were in that one already, and a count past the
+	// slots means samples were lost on the way
+	int first = 0, taken = s->num_samples;
+	if (dk2) {
+		if (had_clock) {
+			taken = (uint16_t)(s->sample_count - info->sample_count);
+			first = OHMD_MAX(s->num_samples - taken, 0);
+		}
+		info->sample_count = s->sample_count;
+	}
+	int fresh = s->num_samples - first;
+
+	uint64_t now = devclock_update(clock, s->timestamp,
+				       dk2 ? DEVCLOCK_WRAP_DK2 :
+				       DEVCLOCK_WRAP_DK1, taken,
+				       info->report_time);
+	float period = (float)clock->period;
+
+	// from the last sample of the previous report to the first new one
+	float dt = period;
+	if (had_clock && clock->resets == resets && now > last) {
+		dt = (now - last) * 1e-6f - (fresh - 1) * period;
+		if (dt <= 0) {
+			dt = period;
+		}
+
+		// DK1 reports have no counter, only the time between them
+		int lost = dk2 ? taken - fresh : (int)(dt / period + 0.5f) - 1;
+		if (lost > 0) {
+			info->health.gaps++;
+			info->health.dropped += lost;
+			// integrating the last rate across a long gap does
+			// more harm than leaving the orientation where it was
+			if (dt > info->bridge_max) {
+				dt = period;
+			}
+		}
+	}
+	info->health.repeated += first;
+	info->health.samples += fresh;
+
+	// nothing new: the time below would land a period past the last
+	// sample, and the pose is the one already published
+	if (!fresh) {
+		return;
+	}
+
+	double sample_time = devclock_host_time(clock, now) -
+	    (fresh - 1) * clock->period;
+
+	if (info->profile && clock->fitted) {
+		double off = info->report_time - devclock_host_time(clock, now);
+		hist_record(&info->profile->stage[HID_STAGE_JITTER],
+			    off < 0 ? -off : off);
+	}
+
+	for (int i = first; i < s->num_samples; i++) {
 		vec3f_from_rift_vec(s->samples[i].accel, &info->raw_accel);
 		vec3f_from_rift_vec(s->samples[i].gyro, &info->raw_gyro);
 
-//              ofusion_update(&info->sensor_fusion, dt, &info->raw_gyro, &info->raw_accel, &info->raw_mag);
+		vec3f gyro;
+		calib_update(&info->calib, s->temperature, &info->raw_gyro,
+			     &info->raw_accel, &gyro);
+		ofusion_update(&info->sensor_fusion, dt, &gyro,
+			       &info->raw_accel, have_mag ? &mag : NULL);
+		record_sample(info, sample_time, &info->sensor_fusion.orient,
+			      &info->sensor_fusion.ang_vel);
+		if (info->shm) {
+			shm_publish_sample(info->shm, s->timestamp, sample_time,
+					   &info->raw_accel, &info->raw_gyro,
+					   &info->raw_mag);
+		}
+		if (info->callbacks.sample) {
+			HMDSample sample = { s->timestamp, sample_time,
+				info->raw_accel, info->raw_gyro, info->raw_mag
+			};
+			info->callbacks.sample(info->callbacks.user, &sample);
+		}
 //              LOGI("raw_gyro = %f, %f, %f\nraw_accel = %f, %f, %f\nraw_mag = %f, %f, %f\n\n",
 //                      info->raw_gyro.x,  info->raw_gyro.y,  info->raw_gyro.z,
 //                      info->raw_accel.x, info->raw_accel.y, info->raw_accel.z,
 //                      info->raw_mag.x,   info->raw_mag.y,   info->raw_mag.z);
-		dt = TICK_LEN;	// TODO: query the Rift for the sample rate
+		dt = period;
+		if (i + 1 < s->num_samples) {
+			sample_time += clock->period;
+		}
+	}
+
+	if (info->profile) {
+		profile_mark(info, HID_STAGE_FUSE);
+	}
+
+	HMDPose pose;
+	pose.orient = info->sensor_fusion.orient;
+	pose.ang_vel = info->sensor_fusion.ang_vel;
+	pose.gyro = info->raw_gyro;
+	pose.accel = info->raw_accel;
+	pose.timestamp = s->timestamp;
+	pose.host_time = info->report_time;
+	pose.sample_time = sample_time;
+	pose.mag_quality = magcal_quality(&info->magcal);
+	HID_PublishPose(info, &pose);
+	if (info->shm) {
+		shm_publish_pose(info->shm, &pose);
+	}
+	if (info->callbacks.pose) {
+		info->callbacks.pose(info->callbacks.user, &pose);
+	}
+
+	if (info->profile) {
+		profile_mark(info, HID_STAGE_PUBLISH);
+	}
+}
+
+/* Firmware orientation instead of host fusion: no samples to decode or
+   filter, the angular velocity for prediction comes from the change since
+   the last report */
+static void handle_fw_quat_msg(HMDHidInfo * info, unsigned char *buffer,
+			       int size)
+{
+	if (size < PKT_FW_QUAT_SIZE) {
+		LOGE("invalid packet size (expected %d or more but got %d)",
+		     PKT_FW_QUAT_SIZE, size);
+		info->health.decode_errors++;
+		return;
+	}
+
+	uint32_t timestamp = pkt_fw_quat_timestamp(buffer);
+	quatf q;
+	decode_fw_quat(buffer + PKT_FW_QUAT_OFFSET, &q);
+
+	if (info->profile) {
+		profile_mark(info, HID_STAGE_DECODE);
+	}
+
+	hmd_devclock *clock = &info->clock;
+	int had_clock = clock->started;
+	uint64_t resets = clock->resets;
+	uint64_t now = devclock_update(clock, timestamp,
+				       buffer[0] == RIFT_IRQ_SENSORS_DK2 ?
+				       DEVCLOCK_WRAP_DK2 : DEVCLOCK_WRAP_DK1,
+				       1, info->report_time);
+
+	HMDPose pose;
+	memset(&pose, 0, sizeof(pose));
+
+	// q_last^-1 q is the turn since the last report, 2 (x, y, z) / dt
+	// of it the rate for small turns
+	if (had_clock && clock->resets == resets && now > info->fw_time) {
+		quatf inv = { {-info->fw_orient.x, -info->fw_orient.y,
+			       -info->fw_orient.z, info->fw_orient.w} };
+		quatf d;
+		oquatf_mult(&inv, &q, &d);
+
+		float k = (d.w < 0 ? -2.0f : 2.0f) / ((now - info->fw_time) *
+						       1e-6f);
+		pose.ang_vel = (vec3f) { {d.x * k, d.y * k, d.z * k} };
+	}
+	info->fw_orient = q;
+	info->fw_time = now;
+
+	if (info->profile) {
+		profile_mark(info, HID_STAGE_FUSE);
+	}
+
+	pose.orient = q;
+	pose.timestamp = timestamp;
+	pose.host_time = info->report_time;
+	pose.sample_time = devclock_host_time(clock, now);
+	record_sample(info, pose.sample_time, &q, &pose.ang_vel);
+	HID_PublishPose(info, &pose);
+	if (info->shm) {
+		shm_publish_pose(info->shm, &pose);
+	}
+	if (info->callbacks.pose) {
+		info->callbacks.pose(info->callbacks.user, &pose);
+	}
+
+	if (info->profile) {
+		profile_mark(info, HID_STAGE_PUBLISH);
+	}
+}
+
+void pose_buffer_publish(HMDPoseBuffer * buf, const HMDPose * pose)
+{
+	unsigned seq = atomic_load_explicit(&buf->seq, memory_order_relaxed);
+
+	// readers keep using slot (seq >> 1) & 1 while we fill the other one
+	atomic_store_explicit(&buf->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	buf->slot[((seq >> 1) + 1) & 1] = *pose;
+
+	atomic_store_explicit(&buf->seq, seq + 2, memory_order_release);
+}
+
+int pose_buffer_get(const HMDPoseBuffer * buf, HMDPose * pose)
+{
+	unsigned seq, now;
+
+	do {
+		seq = atomic_load_explicit(&buf->seq, memory_order_acquire);
+		if (seq < 2) {
+			return -1;
+		}
+
+		memcpy(pose, &buf->slot[(seq >> 1) & 1], sizeof(HMDPose));
+
+		atomic_thread_fence(memory_order_acquire);
+		now = atomic_load_explicit(&buf->seq, memory_order_relaxed);
+
+		// only retry if the writer came back around to our slot
+	} while (now - (seq & ~1u) > 2);
+
+	return 0;
+}
+
+void HID_PublishPose(HMDHidInfo * info, const HMDPose * pose)
+{
+	pose_buffer_publish(&info->pose, pose);
+}
+
+int HID_GetLatestPose(HMDHidInfo * info, HMDPose * pose)
+{
+	return pose_buffer_get(&info->pose, pose);
+}
+
+/* orient turned at ang_vel, in the sensor frame, for dt seconds */
+static quatf predict(const quatf * orient, const vec3f * ang_vel, double dt)
+{
+	dt = OHMD_MAX(OHMD_MIN(dt, MAX_PREDICTION), -MAX_PREDICTION);
+
+	float rate = ovec3f_get_length(ang_vel);
+	if (rate == 0.0f) {
+		return *orient;
+	}
+
+	// angular velocity is in the sensor frame, so rotate on the right
+	quatf delta, predicted;
+	oquatf_init_axis(&delta, ang_vel, rate * (float)dt);
+	oquatf_mult(orient, &delta, &predicted);
+	oquatf_normalize_me(&predicted);
+
+	return predicted;
+}
+
+quatf HID_PredictPose(HMDHidInfo * info, double target_time)
+{
+	HMDPose pose;
+	quatf identity = { {0, 0, 0, 1} };
+
+	if (HID_GetLatestPose(info, &pose)) {
+		return identity;
+	}
+
+	return predict(&pose.orient, &pose.ang_vel,
+		       target_time - pose.sample_time);
+}
+
+int HID_GetPoseAt(HMDHidInfo * info, double t, HMDPose * pose)
+{
+	hmd_pose_sample s;
+	int res = history_at(&info->history, t, &s);
+
+	if (res < 0) {
+		return -1;
+	}
+
+	memset(pose, 0, sizeof(HMDPose));
+	pose->orient = res > 0 ? predict(&s.orient, &s.ang_vel, t - s.time) :
+	    s.orient;
+	pose->ang_vel = s.ang_vel;
+	pose->sample_time = t;
+
+	return 0;
+}
+
+void HID_SetResampleRate(HMDHidInfo * info, double hz)
+{
+	info->resample_period = hz > 0 ? 1.0 / hz : 0;
+	info->next_resample = 0;
+}
+
+static int read_poses(const hmd_pose_history * h, uint64_t * cursor,
+		      HMDPose * out, int max)
+{
+	hmd_pose_sample s;
+	int n = 0;
+
+	while (n < max && history_read(h, cursor, &s, 1)) {
+		memset(&out[n], 0, sizeof(HMDPose));
+		out[n].orient = s.orient;
+		out[n].ang_vel = s.ang_vel;
+		out[n].sample_time = s.time;
+		n++;
 	}
 
-	info->last_imu_timestamp = s->timestamp;
+	return n;
+}
+
+int HID_ReadResampled(HMDHidInfo * info, uint64_t * cursor, HMDPose * out,
+		      int max)
+{
+	return read_poses(&info->resampled, cursor, out, max);
+}
+
+int HID_ReadPoses(HMDHidInfo * info, uint64_t * cursor, HMDPose * out,
+		  int max)
+{
+	return read_poses(&info->history, cursor, out, max);
+}
+
+void HID_SetCallbacks(HMDHidInfo * info, const HMDCallbacks * callbacks)
+{
+	if (callbacks) {
+		info->callbacks = *callbacks;
+	} else {
+		memset(&info->callbacks, 0, sizeof(HMDCallbacks));
+	}
 }
 
 static int get_feature_report(HMDHidInfo * info, char cmd, unsigned char *buf)
 {
 	memset(buf, 0, FEATURE_BUFFER_SIZE);
 	buf[0] = (unsigned char)cmd;
-	return hid_get_feature_report(info->handle, buf, FEATURE_BUFFER_SIZE);
+	atomic_fetch_add_explicit(&info->stats.feature_reports, 1,
+				  memory_order_relaxed);
+	return info->backend->get_feature(info->dev, buf, FEATURE_BUFFER_SIZE);
 }
 
 static int send_feature_report(HMDHidInfo * info, const unsigned char *data,
 			       size_t length)
 {
-	return hid_send_feature_report(info->handle, data, length);
+	atomic_fetch_add_explicit(&info->stats.feature_reports, 1,
+				  memory_order_relaxed);
+	return info->backend->send_feature(info->dev, data, length);
 }
 
-static double HID_get_tick()
+double HID_get_tick()
 {
 	struct timespec now;
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	return (double)now.tv_sec * 1.0 + (double)now.tv_nsec / 1000000000.0;
 }
 
-int HID_Init(HMDHidInfo * info)
+static int read_report(HMDHidInfo * info, unsigned char *buf, size_t length,
+		       int timeout)
+{
+	return info->backend->read(info->dev, buf, length, timeout,
+				   &info->report_time);
+}
+
+typedef enum {
+	INIT_GET_CONFIG,
+	INIT_SET_CONFIG,
+	INIT_SET_INTERVAL,	// ask for a report every sample, then set
+	INIT_GET_RANGE,
+	INIT_GET_SERIAL,
+	INIT_SKIP_IF_CACHED,	// straight to activation if the config matches
+	INIT_SET_CACHED,
+	INIT_REQUIRE_CACHED,	// abandon the sequence unless the config matches
+	INIT_ACTIVATE
+} init_op;
+
+// The startup sequence of the Windows driver, see win-pimax.txt
+static const init_op full_init[] = {
+	INIT_GET_CONFIG,	// 33
+	INIT_SET_CONFIG,	// 35
+	INIT_GET_CONFIG,	// 37
+	INIT_GET_CONFIG,	// 39
+	INIT_SET_CONFIG,	// 41
+	INIT_GET_CONFIG,	// 43
+	INIT_GET_CONFIG,	// 45
+	INIT_SET_INTERVAL,	// 47
+	INIT_GET_CONFIG,	// 49
+	INIT_SET_CONFIG,	// 51
+	INIT_GET_CONFIG,	// 53
+	INIT_GET_RANGE,
+	INIT_GET_SERIAL,	// 55
+	INIT_ACTIVATE		// 57
+};
+
+// Known headset: put it back into the config it ended up in last time
+static const init_op fast_init[] = {
+	INIT_GET_CONFIG,
+	INIT_SKIP_IF_CACHED,
+	INIT_SET_CACHED,
+	INIT_GET_CONFIG,
+	INIT_REQUIRE_CACHED,
+	INIT_ACTIVATE
+};
+
+#define CONFIG_CACHE_MAGIC 0x47464350	// "PCFG"
+#define CONFIG_CACHE_VERSION 1
+#define SERIAL_REPORT 240	// the serial in ASCII from byte 4
+
+typedef struct {
+	pkt_sensor_config config;
+	pkt_sensor_range range;
+} config_cache;
+
+typedef struct {
+	const config_cache *cache;
+	int have_config;	// the last read of the config decoded
+} init_state;
+
+static int config_matches(const pkt_sensor_config * a,
+			  const pkt_sensor_config * b)
+{
+	return a->flags == b->flags && a->packet_interval == b->packet_interval
+	    && a->keep_alive_interval == b->keep_alive_interval;
+}
+
+static void read_serial(HMDHidInfo * info, const unsigned char *buffer,
+			int size)
+{
+	int n = 0;
+
+	for (int i = 4; i < size && n < (int)sizeof(info->serial) - 1; i++) {
+		if (buffer[i] < '!' || buffer[i] > '~') {
+			break;
+		}
+		info->serial[n++] = buffer[i];
+	}
+	info->serial[n] = 0;
+}
+
+/* Returns 0 to go on, 1 to skip to activation and -1 to abandon */
+static int init_step(HMDHidInfo * info, init_op op, init_state * state)
 {
 	unsigned char buffer[FEATURE_BUFFER_SIZE];
-	wchar_t wstr[MAX_STR];
+	int size;
 
-	int res = hid_init();
+	switch (op) {
+	case INIT_GET_CONFIG:
+		state->have_config = 0;
+		size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
+		if (size > 0) {
+			DUMP(buffer, size);
+			state->have_config =
+			    decode_sensor_config(&info->sensor_config, buffer,
+						 size);
+			dump_packet_sensor_config(&info->sensor_config);
+		}
+		return 0;
 
-	info->handle = hid_open(0x0483, 0x0021, NULL);
+	case INIT_SET_INTERVAL:
+		info->sensor_config.packet_interval = 1;
+		// fall through
+	case INIT_SET_CONFIG:
+		size = encode_sensor_config(buffer, &info->sensor_config);
+		if (send_feature_report(info, buffer, size) == -1) {
+			LOGE("error setting the sensor config");
+		}
+		return 0;
 
-	res = hid_get_manufacturer_string(info->handle, wstr, MAX_STR);
-	printf("Manufacturer String: %ls\n", wstr);
+	case INIT_GET_RANGE:
+		size = get_feature_report(info, RIFT_CMD_RANGE, buffer);
+		if (size > 0) {
+			DUMP(buffer, size);
+			decode_sensor_range(&info->sensor_range, buffer, size);
+			dump_packet_sensor_range(&info->sensor_range);
+		}
+		return 0;
 
-	res = hid_get_product_string(info->handle, wstr, MAX_STR);
-	printf("Product String: %ls\n", wstr);
+	case INIT_GET_SERIAL:
+		size = get_feature_report(info, SERIAL_REPORT, buffer);
+		if (size > 0) {
+			DUMP(buffer, size);
+			if (!info->serial[0]) {
+				read_serial(info, buffer, size);
+			}
+		}
+		return 0;
 
-	res = hid_get_serial_number_string(info->handle, wstr, MAX_STR);
-	printf("Serial Number String: (%d) %ls\n", wstr[0], wstr);
+	case INIT_SKIP_IF_CACHED:
+		return state->have_config
+		    && config_matches(&info->sensor_config,
+				      &state->cache->config) ? 1 : 0;
 
-	hid_set_nonblocking(info->handle, 1);
+	case INIT_SET_CACHED:
+		info->sensor_config = state->cache->config;
+		size = encode_sensor_config(buffer, &info->sensor_config);
+		if (send_feature_report(info, buffer, size) == -1) {
+			LOGE("error setting the sensor config");
+		}
+		return 0;
 
-	int size;
+	case INIT_REQUIRE_CACHED:
+		return state->have_config
+		    && config_matches(&info->sensor_config,
+				      &state->cache->config) ? 0 : -1;
 
-#if 0
-	// Read and decode the sensor range
-	size = get_feature_report(info, RIFT_CMD_RANGE, buffer);
-	if (size) {
-		decode_sensor_range(&info->sensor_range, buffer, size);
-		dump_packet_sensor_range(&info->sensor_range);
+	case INIT_ACTIVATE:
+		size = encode_pimax_cmd_17(buffer);
+		if (send_feature_report(info, buffer, size) == -1) {
+			LOGE("error setting up cmd17");
+		}
+		return 0;
 	}
 
-	// Read and decode display information
-	size = get_feature_report(info, RIFT_CMD_DISPLAY_INFO, buffer);
-	if (size) {
-		decode_sensor_display_info(&info->display_info, buffer, size);
-		dump_packet_sensor_display_info(&info->display_info);
+	return -1;
+}
+
+static int run_init(HMDHidInfo * info, const init_op * ops, int num_ops,
+		    init_state * state)
+{
+	for (int i = 0; i < num_ops; i++) {
+		int res = init_step(info, ops[i], state);
+		if (res < 0) {
+			return -1;
+		}
+		// skip to the last step, the activation
+		if (res > 0) {
+			i = num_ops - 2;
+		}
 	}
-#endif
 
-	// Read and decode the sensor config
-	// 33
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	return 0;
+}
+
+static int init_sensor(HMDHidInfo * info)
+{
+	config_cache cache;
+	init_state state = { &cache, 0 };
+
+	ofusion_init(&info->sensor_fusion);
+	history_init(&info->history, info->history_samples, HISTORY_SAMPLES);
+	history_init(&info->resampled, info->resampled_samples,
+		     RESAMPLED_SAMPLES);
+	calib_init(&info->calib);
+	if (!calib_load(&info->calib, info->serial)) {
+		LOGI("init: restored the gyro calibration of %s", info->serial);
+	}
+	magcal_init(&info->magcal);
+	if (!magcal_load(&info->magcal, info->serial)) {
+		LOGI("init: restored the magnetometer fit of %s", info->serial);
+	}
+	devclock_init(&info->clock, TICK_LEN);
+	info->bridge_max = HID_BRIDGE_MAX;
+	info->keep_alive.margin = HID_KEEP_ALIVE_MARGIN;
+
+	if (!cache_load(info->serial, "config", CONFIG_CACHE_MAGIC,
+			CONFIG_CACHE_VERSION, &cache, sizeof(cache))) {
+		// the fast path never reads the range, whichever way it goes
+		info->sensor_range = cache.range;
+		if (!run_init(info, fast_init, OHMD_ARRAY_SIZE(fast_init),
+			      &state)) {
+			LOGI("init: restored the cached config of %s",
+			     info->serial);
+			info->stats.fast_init = 1;
+			info->last_keep_alive = HID_get_tick();
+			return 0;
+		}
+		LOGI("init: cached config of %s did not stick", info->serial);
 	}
 
-	// 35
-	size = encode_sensor_config(buffer, &info->sensor_config);
-	if (send_feature_report(info, buffer, size) == -1) {
-		LOGE("error setting up cmd17");
+	run_init(info, full_init, OHMD_ARRAY_SIZE(full_init), &state);
+
+	// the range is cached as read, some firmware does not answer it
+	if (state.have_config) {
+		cache.config = info->sensor_config;
+		cache.range = info->sensor_range;
+		cache_store(info->serial, "config", CONFIG_CACHE_MAGIC,
+			    CONFIG_CACHE_VERSION, &cache, sizeof(cache));
 	}
 
-	// 37
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	info->last_keep_alive = HID_get_tick();
+
+	return 0;
+}
+
+static int start_device(HMDHidInfo * info, const hmd_backend * backend,
+			void *dev)
+{
+	info->backend = backend;
+	info->dev = dev;
+
+	// captures have no string descriptors, the serial report stands in
+	if (!info->serial[0]) {
+		unsigned char buffer[FEATURE_BUFFER_SIZE];
+		int size = get_feature_report(info, SERIAL_REPORT, buffer);
+		if (size > 0) {
+			read_serial(info, buffer, size);
+		}
 	}
 
-	// 39
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	return init_sensor(info);
+}
+
+static const hmd_backend *backends[] = {
+	&backend_hidapi, &backend_hidraw, &backend_replay
+};
+
+const hmd_backend *backend_find(const char *name)
+{
+	for (int i = 0; i < OHMD_ARRAY_SIZE(backends); i++) {
+		if (!strcmp(backends[i]->name, name)) {
+			return backends[i];
+		}
 	}
+	return NULL;
+}
 
-	// 41
-	size = encode_sensor_config(buffer, &info->sensor_config);
-	if (send_feature_report(info, buffer, size) == -1) {
-		LOGE("error setting up cmd17");
+int HID_Enumerate(char serials[][CACHE_SERIAL_MAX], int max)
+{
+	return hidapi_enumerate(serials, max);
+}
+
+int HID_Init(HMDHidInfo * info)
+{
+	return HID_InitSerial(info, NULL);
+}
+
+int HID_InitSerial(HMDHidInfo * info, const char *serial)
+{
+	return HID_InitDevice(info, "hidapi", serial);
+}
+
+int HID_InitDevice(HMDHidInfo * info, const char *backend, const char *serial)
+{
+	const hmd_backend *b = backend_find(backend);
+	void *dev;
+
+	memset(info, 0, sizeof(HMDHidInfo));
+	info->init_start = HID_get_tick();
+
+	if (b == &backend_hidapi) {
+		dev = hidapi_open(serial, info->serial, sizeof(info->serial));
+	} else if (b == &backend_hidraw) {
+		dev = hidraw_open(serial, info->serial, sizeof(info->serial));
+	} else {
+		LOGE("no device backend called %s", backend);
+		return -1;
 	}
 
-	// 43
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	if (!dev) {
+		return -1;
 	}
 
-	// 45
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	return start_device(info, b, dev);
+}
+
+int HID_InitBackend(HMDHidInfo * info, const hmd_backend * backend, void *dev)
+{
+	memset(info, 0, sizeof(HMDHidInfo));
+	info->init_start = HID_get_tick();
+
+	return start_device(info, backend, dev);
+}
+
+int HID_InitReplay(HMDHidInfo * info, const char *path, replay_mode mode)
+{
+	memset(info, 0, sizeof(HMDHidInfo));
+	info->init_start = HID_get_tick();
+
+	hmd_replay *replay = replay_open(path, mode);
+	if (!replay) {
+		return -1;
 	}
 
-	info->sensor_config.packet_interval = 1;
-	// 47
-	size = encode_sensor_config(buffer, &info->sensor_config);
-	if (send_feature_report(info, buffer, size) == -1) {
-		LOGE("error setting up cmd17");
+	// the feature reports of the capture answer the startup sequence
+	return start_device(info, &backend_replay, replay);
+}
+
+int HID_EnableProfile(HMDHidInfo * info)
+{
+	if (!info->profile) {
+		info->profile = calloc(1, sizeof(HMDHidProfile));
+	}
+	return info->profile ? 0 : -1;
+}
+
+int HID_Close(HMDHidInfo * info)
+{
+	HID_StopReader(info);
+	HID_StopKeepAlive(info);
+
+	if (info->calib.dirty) {
+		calib_store(&info->calib, info->serial);
 	}
+	if (info->magcal.dirty) {
+		magcal_store(&info->magcal, info->serial);
+	}
+
+	free(info->profile);
+	info->profile = NULL;
 
-	// 49
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	if (info->dev) {
+		info->backend->close(info->dev);
+		info->dev = NULL;
 	}
 
-	// 51
-	size = encode_sensor_config(buffer, &info->sensor_config);
-	if (send_feature_report(info, buffer, size) == -1) {
+	return 0;
+}
+
+static double keep_alive_period(HMDHidInfo * info)
+{
+	int interval = info->sensor_config.keep_alive_interval ?
+	    info->sensor_config.keep_alive_interval : KEEP_ALIVE_DEFAULT_MS;
+	double period = interval / 1000.0 - info->keep_alive.margin;
+
+	return OHMD_MAX(period, KEEP_ALIVE_MIN_PERIOD);
+}
+
+static int send_keep_alive(HMDHidInfo * info)
+{
+	unsigned char buffer[FEATURE_BUFFER_SIZE];
+	HMDKeepAliveStats *stats = &info->keep_alive.stats;
+	double start = HID_get_tick();
+
+	int size = encode_pimax_cmd_17(buffer);
+	int res = send_feature_report(info, buffer, size);
+	double end = HID_get_tick();
+
+	if (res == -1) {
 		LOGE("error setting up cmd17");
+		stats->failed++;
+	} else {
+		stats->sent++;
 	}
 
-	// 53
-	size = get_feature_report(info, RIFT_CMD_SENSOR_CONFIG, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_config(&info->sensor_config, buffer, size);
-		dump_packet_sensor_config(&info->sensor_config);
+	TRACE(TRACE_KEEP_ALIVE);
+
+	// the device stops streaming once its own interval runs out
+	double interval = info->sensor_config.keep_alive_interval ?
+	    info->sensor_config.keep_alive_interval / 1000.0 :
+	    KEEP_ALIVE_DEFAULT_MS / 1000.0;
+	if (info->last_keep_alive && end - info->last_keep_alive > interval) {
+		stats->missed++;
 	}
 
-	size = get_feature_report(info, RIFT_CMD_RANGE, buffer);
-	if (size) {
-		DUMP(buffer, size);
-		decode_sensor_range(&info->sensor_range, buffer, size);
-		dump_packet_sensor_range(&info->sensor_range);
+	hist_record(&stats->latency, end - start);
+	info->last_keep_alive = end;
+
+	return res;
+}
+
+/* Inline keep-alive for HID_Read() callers that did not start the
+   scheduler */
+static void handle_keep_alive(HMDHidInfo * info)
+{
+	if (info->keep_alive.armed) {
+		return;
 	}
 
-	// 55
-	size = get_feature_report(info, 240, buffer);
-	if (size) {
-		DUMP(buffer, size);
-//      decode_sensor_config(&info->sensor_config, buffer, size);
-//      dump_packet_sensor_config(&info->sensor_config);
+	if (HID_get_tick() - info->last_keep_alive >= keep_alive_period(info)) {
+		send_keep_alive(info);
 	}
+}
 
-	// 57
-	size = encode_pimax_cmd_17(buffer);
-	if (send_feature_report(info, buffer, size) == -1) {
-		LOGE("error setting up cmd17");
+int HID_ArmKeepAlive(HMDHidInfo * info, double margin)
+{
+	HMDKeepAlive *ka = &info->keep_alive;
+	struct itimerspec its;
+
+	if (ka->armed) {
+		return ka->timer_fd;
 	}
 
-	info->last_keep_alive = HID_get_tick();
+	ka->margin = margin;
+	ka->period = keep_alive_period(info);
+	ka->due = info->last_keep_alive + ka->period;
+
+	ka->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (ka->timer_fd < 0) {
+		LOGE("could not create the keep-alive timer");
+		return -1;
+	}
+
+	// absolute first expiry, then every period from there
+	its.it_value.tv_sec = (time_t)ka->due;
+	its.it_value.tv_nsec =
+	    (long)((ka->due - (double)its.it_value.tv_sec) * 1e9);
+	its.it_interval.tv_sec = (time_t)ka->period;
+	its.it_interval.tv_nsec =
+	    (long)((ka->period - (double)its.it_interval.tv_sec) * 1e9);
+	if (timerfd_settime(ka->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		LOGE("could not arm the keep-alive timer");
+		close(ka->timer_fd);
+		return -1;
+	}
+	ka->armed = 1;
+
+	return ka->timer_fd;
+}
+
+void HID_HandleKeepAlive(HMDHidInfo * info)
+{
+	HMDKeepAlive *ka = &info->keep_alive;
+	uint64_t expirations;
+
+	if (read(ka->timer_fd, &expirations, sizeof(expirations)) !=
+	    sizeof(expirations) || !expirations) {
+		return;
+	}
+
+	// expirations past the first were slept through
+	ka->due += (expirations - 1) * ka->period;
+	ka->stats.overruns += expirations - 1;
+	hist_record(&ka->stats.lateness, HID_get_tick() - ka->due);
+	ka->due += ka->period;
+
+	send_keep_alive(info);
+}
+
+static void *keep_alive_thread(void *arg)
+{
+	HMDHidInfo *info = arg;
+	HMDKeepAlive *ka = &info->keep_alive;
+	struct pollfd fds[2] = {
+		{.fd = ka->timer_fd,.events = POLLIN},
+		{.fd = ka->stop_fd,.events = POLLIN}
+	};
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			continue;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+		if (fds[0].revents) {
+			HID_HandleKeepAlive(info);
+		}
+	}
+
+	return NULL;
+}
+
+int HID_StartKeepAlive(HMDHidInfo * info, double margin)
+{
+	HMDKeepAlive *ka = &info->keep_alive;
+
+	if (ka->armed) {
+		return 0;
+	}
+
+	if (HID_ArmKeepAlive(info, margin) < 0) {
+		return -1;
+	}
+
+	ka->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (ka->stop_fd < 0) {
+		LOGE("could not create the keep-alive timer");
+		HID_StopKeepAlive(info);
+		return -1;
+	}
+
+	if (pthread_create(&ka->thread, NULL, keep_alive_thread, info)) {
+		LOGE("could not start keep-alive thread");
+		close(ka->stop_fd);
+		HID_StopKeepAlive(info);
+		return -1;
+	}
+	ka->started = 1;
 
 	return 0;
 }
 
-int HID_Close(HMDHidInfo * info)
+void HID_StopKeepAlive(HMDHidInfo * info)
 {
-	hid_close(info->handle);
-	return hid_exit();
+	HMDKeepAlive *ka = &info->keep_alive;
+	uint64_t one = 1;
+
+	if (ka->started) {
+		if (write(ka->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+			LOGE("could not stop the keep-alive thread");
+		}
+		pthread_join(ka->thread, NULL);
+		close(ka->stop_fd);
+		ka->started = 0;
+	}
+	if (ka->armed) {
+		close(ka->timer_fd);
+		ka->armed = 0;
+	}
 }
 
-void HID_Read(HMDHidInfo * info)
+/* Publish the health window once it is HEALTH_WINDOW long, or whatever
+   there is on flush, and start the next one */
+static void health_tick(HMDHidInfo * info, double now, int flush)
 {
-	unsigned char buffer[FEATURE_BUFFER_SIZE];
+	HMDHidHealth *h = &info->health;
+	HMDHidHealthBuffer *buf = &info->health_pub;
 
-//#if 1
-	// Handle keep alive messages
-	double t = HID_get_tick();
-//LOGI("TIME: %f", t);
+	if (!h->start) {
+		h->start = now;
+		return;
+	}
+	if (now - h->start < HEALTH_WINDOW && !flush) {
+		return;
+	}
+	h->length = now - h->start;
 
-	if (t - info->last_keep_alive >=
-	    (double)info->sensor_config.keep_alive_interval / 1000.0 - .2) {
-		int size = encode_pimax_cmd_17(buffer);
-		if (send_feature_report(info, buffer, size) == -1) {
-			LOGE("error setting up cmd17");
+	// only this thread writes, so the published total is ours to read
+	HMDHidHealth total = buf->total;
+	if (!total.start) {
+		total.start = h->start;
+	}
+	total.length += h->length;
+	total.reports += h->reports;
+	total.samples += h->samples;
+	total.dropped += h->dropped;
+	total.repeated += h->repeated;
+	total.gaps += h->gaps;
+	total.timeouts += h->timeouts;
+	total.decode_errors += h->decode_errors;
+	total.interval_sum += h->interval_sum;
+	total.interval_max = OHMD_MAX(total.interval_max, h->interval_max);
+
+	unsigned seq = atomic_load_explicit(&buf->seq, memory_order_relaxed);
+	atomic_store_explicit(&buf->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	buf->second = *h;
+	buf->total = total;
+
+	atomic_store_explicit(&buf->seq, seq + 2, memory_order_release);
+
+	memset(h, 0, sizeof(HMDHidHealth));
+	h->start = now;
+}
+
+int HID_GetHealth(HMDHidInfo * info, HMDHidHealth * second,
+		  HMDHidHealth * total)
+{
+	const HMDHidHealthBuffer *buf = &info->health_pub;
+	HMDHidHealth s, t;
+	unsigned seq;
+
+	do {
+		seq = atomic_load_explicit(&buf->seq, memory_order_acquire);
+		if (seq < 2) {
+			return -1;
 		}
 
-		LOGI("OK1");
+		memcpy(&s, &buf->second, sizeof(HMDHidHealth));
+		memcpy(&t, &buf->total, sizeof(HMDHidHealth));
+
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1)
+		 || atomic_load_explicit(&buf->seq,
+					 memory_order_relaxed) != seq);
 
-		// Update the time of the last keep alive we have sent.
-		info->last_keep_alive = t;
+	if (second) {
+		*second = s;
+	}
+	if (total) {
+		*total = t;
 	}
-//#endif
 
-	// Read all the messages from the device.
-//      while(1) {
-//LOGI("READSTART");
-	int size =
-	    hid_read_timeout(info->handle, buffer, FEATURE_BUFFER_SIZE, 100000);
-//LOGI("READEND");
-	if (size < 0) {
-		LOGE("error reading from device");
-		return;
-	} else if (size == 0) {
+	return 0;
+}
+
+static void handle_report(HMDHidInfo * info, unsigned char *buffer, int size)
+{
+	HMDHidProfile *profile = info->profile;
 
-		LOGI("No data!");
-//    size = encode_pimax_cmd_17(buffer);
-//    if (send_feature_report(info, buffer, size) == -1) {
-//      LOGE("error setting up cmd17");
-//    }
+	if (profile) {
+		if (profile->last_report_time) {
+			hist_record(&profile->stage[HID_STAGE_INTERVAL],
+				    info->report_time -
+				    profile->last_report_time);
+		}
+		profile->last_report_time = info->report_time;
+		profile->mark = info->report_time;
+		profile_mark(info, HID_STAGE_READ);
+	}
 
-		return;		// No more messages, return.
+	if (info->rec) {
+		rec_write(info->rec, buffer, size, info->report_time);
 	}
 
 	//LOGI("OK2 %d", size);
 
 //	DUMP(buffer, size);
 
-#if 1
-	// currently the only message type the hardware supports (I think)
-	if (buffer[0] == RIFT_IRQ_SENSORS || buffer[0] == RIFT_IRQ_SENSORS_DK2) {
+	if (info->orient_source == HID_ORIENT_FIRMWARE
+	    && size == PKT_FW_QUAT_REPORT_SIZE) {
+		handle_fw_quat_msg(info, buffer, size);
+	} else if (buffer[0] == RIFT_IRQ_SENSORS
+		   || buffer[0] == RIFT_IRQ_SENSORS_DK2) {
+		// currently the only message type the hardware supports (I think)
+#ifndef HMD_NO_TRACE
 		unsigned short *datu = (unsigned short *) &buffer[12];
 		short *dats = (short *) &buffer[12];
 
 		// quaternion (unsigned shor[4])
-		LOGI("Q: %d %d %d %d", datu[0], datu[1], datu[2], datu[3]);
+		TRACE(TRACE_QUAT, datu[0], datu[1], datu[2], datu[3]);
 		// euler, acceleration, gyroscope, xxx?
-		LOGI("Q: %d %d %d %d %d %d %d %d %d", dats[4], dats[5], dats[6], datu[7], datu[8], datu[9], datu[10], datu[11], datu[12]);
-//		handle_tracker_sensor_msg(info, buffer, size);
+		TRACE(TRACE_QUAT_RAW, dats[4], dats[5], dats[6], datu[7], datu[8], datu[9], datu[10], datu[11], datu[12]);
+#endif
+		if (info->orient_source == HID_ORIENT_FIRMWARE
+		    && !info->fw_missing) {
+			LOGW("no firmware orientation in %d byte reports, "
+			     "fusing them instead", size);
+			info->fw_missing = 1;
+		}
+		handle_tracker_sensor_msg(info, buffer, size);
 	} else {
 		LOGE("unknown message type: %u", buffer[0]);
+		info->health.decode_errors++;
 	}
-#endif
-//      }
+
+	// time from the report becoming available to it being decoded
+	double now = HID_get_tick();
+	double latency = now - info->report_time;
+	if (!info->stats.num_reports) {
+		info->stats.first_sample = now - info->init_start;
+	}
+	info->stats.num_reports++;
+	info->stats.latency_sum += latency;
+	info->stats.latency_max = OHMD_MAX(info->stats.latency_max, latency);
+
+	HMDHidHealth *h = &info->health;
+	if (info->last_report_time) {
+		double interval = info->report_time - info->last_report_time;
+		h->interval_sum += interval;
+		h->interval_max = OHMD_MAX(h->interval_max, interval);
+	}
+	info->last_report_time = info->report_time;
+	h->reports++;
+	health_tick(info, now, 0);
+
+	if (profile) {
+		hist_record(&profile->stage[HID_STAGE_TOTAL], latency);
+	}
+}
+
+int HID_Read(HMDHidInfo * info)
+{
+	unsigned char buffer[FEATURE_BUFFER_SIZE];
+
+	handle_keep_alive(info);
+
+	// Poll for a message without blocking, see HID_StartReader() for
+	// handing reports off as soon as they arrive.
+	int size = read_report(info, buffer, FEATURE_BUFFER_SIZE, 0);
+	if (size < 0) {
+		LOGE("error reading from device");
+		return -1;
+	} else if (size == 0) {
+		return 0;	// No more messages, return.
+	}
+
+	handle_report(info, buffer, size);
+
+	return size;
 }
 
-int main(int argc, char *argv[])
+int HID_GetReadFd(HMDHidInfo * info)
 {
-	HMDHidInfo info;
+	return info->backend->fd ? info->backend->fd(info->dev) : -1;
+}
 
-	HID_Init(&info);
+int HID_HandleReadable(HMDHidInfo * info)
+{
+	unsigned char buffer[FEATURE_BUFFER_SIZE];
+	int size;
 
-	while (1) {
-		HID_Read(&info);
-		usleep(1000);
+	while ((size = read_report(info, buffer, FEATURE_BUFFER_SIZE, 0)) > 0) {
+		handle_report(info, buffer, size);
+	}
+	if (size < 0) {
+		LOGE("error reading from device");
+		health_tick(info, HID_get_tick(), 1);
+		return -1;
 	}
 
-	HID_Close(&info);
+	return 0;
+}
+
+int HID_SetRealtime(HMDHidInfo * info, int cpu, int priority)
+{
+	if (cpu < -1 || cpu >= CPU_SETSIZE
+	    || priority < sched_get_priority_min(SCHED_FIFO)
+	    || priority > sched_get_priority_max(SCHED_FIFO)) {
+		LOGE("real-time: no cpu %d or SCHED_FIFO priority %d", cpu,
+		     priority);
+		return -1;
+	}
+
+	info->realtime.enabled = 1;
+	info->realtime.cpu = cpu;
+	info->realtime.priority = priority;
 
 	return 0;
 }
+
+/* Lock everything mapped now and later, and keep malloc from trimming or
+   mapping memory, so nothing the reader touches can fault */
+static void realtime_lock(HMDRealtime * rt)
+{
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		LOGW("real-time: could not lock memory: %s", strerror(errno));
+		return;
+	}
+	rt->locked = 1;
+}
+
+/* Attributes that start the reader already pinned and SCHED_FIFO, so not
+   even its first read runs elsewhere */
+static void realtime_attr(const HMDRealtime * rt, int pin, int fifo,
+			  pthread_attr_t * attr)
+{
+	pthread_attr_init(attr);
+
+	if (pin) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(rt->cpu, &set);
+		pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+	}
+
+	if (fifo) {
+		struct sched_param param = {.sched_priority = rt->priority };
+		pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+		pthread_attr_setschedparam(attr, &param);
+	}
+}
+
+/* Start the reader with as much of the real-time setup as the process is
+   allowed: SCHED_FIFO goes first, then the pinning, then the reader starts
+   like any thread */
+static int realtime_create(HMDHidInfo * info, void *(*fn)(void *))
+{
+	HMDRealtime *rt = &info->realtime;
+	int pin = rt->cpu >= 0;
+	const int tries[][2] = { {pin, 1}, {0, 1}, {pin, 0}, {0, 0} };
+	int err = 0, fifo_err = 0, pin_err = 0;
+
+	for (int i = 0; i < 4; i++) {
+		pthread_attr_t attr;
+
+		realtime_attr(rt, tries[i][0], tries[i][1], &attr);
+		err = pthread_create(&info->reader, &attr, fn, info);
+		pthread_attr_destroy(&attr);
+		if (!err) {
+			rt->pinned = tries[i][0];
+			rt->fifo = tries[i][1];
+			break;
+		}
+		fifo_err = tries[i][1] ? err : fifo_err;
+		pin_err = tries[i][0] ? err : pin_err;
+	}
+	if (err) {
+		return -1;
+	}
+
+	if (!rt->fifo) {
+		LOGW("real-time: could not make the reader SCHED_FIFO: %s",
+		     strerror(fifo_err));
+	}
+	if (pin && !rt->pinned) {
+		LOGW("real-time: could not pin the reader to cpu %d: %s",
+		     rt->cpu, strerror(pin_err));
+	}
+
+	return 0;
+}
+
+/* Touch the stack the reader will grow into, for when memory isn't locked */
+static void prefault_stack()
+{
+	unsigned char stack[RT_STACK_PREFAULT];
+	volatile unsigned char *page = stack;
+
+	for (int i = 0; i < RT_STACK_PREFAULT; i += 4096) {
+		page[i] = 0;
+	}
+}
+
+static void *reader_thread(void *arg)
+{
+	HMDHidInfo *info = arg;
+	unsigned char buffer[FEATURE_BUFFER_SIZE];
+
+	if (info->realtime.enabled) {
+		prefault_stack();
+	}
+
+	while (atomic_load(&info->reader_running)) {
+		// Block until the next report, waking up now and then to
+		// notice HID_StopReader().
+		int size = read_report(info, buffer, FEATURE_BUFFER_SIZE,
+				       READER_TIMEOUT_MS);
+		if (size < 0) {
+			if (info->backend != &backend_replay) {
+				LOGE("error reading from device");
+			}
+			break;
+		} else if (size > 0) {
+			handle_report(info, buffer, size);
+		} else {
+			info->health.timeouts++;
+			health_tick(info, HID_get_tick(), 0);
+		}
+	}
+
+	atomic_store(&info->reader_running, 0);
+
+	return NULL;
+}
+
+int HID_StartReader(HMDHidInfo * info)
+{
+	if (info->reader_started) {
+		return 0;
+	}
+
+	// reads block now, keep the device alive from its own thread unless
+	// someone else drives the timer
+	int own_keep_alive = !info->keep_alive.armed;
+	if (HID_StartKeepAlive(info, info->keep_alive.margin)) {
+		return -1;
+	}
+
+	if (info->realtime.enabled) {
+		realtime_lock(&info->realtime);
+	}
+
+	atomic_store(&info->reader_running, 1);
+	if (info->realtime.enabled ? realtime_create(info, reader_thread) :
+	    pthread_create(&info->reader, NULL, reader_thread, info)) {
+		LOGE("could not start reader thread");
+		atomic_store(&info->reader_running, 0);
+		if (own_keep_alive) {
+			HID_StopKeepAlive(info);
+		}
+		return -1;
+	}
+	info->reader_started = 1;
+
+	return 0;
+}
+
+int HID_ReaderRunning(HMDHidInfo * info)
+{
+	return atomic_load(&info->reader_running);
+}
+
+void HID_StopReader(HMDHidInfo * info)
+{
+	if (!info->reader_started) {
+		return;
+	}
+
+	atomic_store(&info->reader_running, 0);
+	pthread_join(info->reader, NULL);
+	info->reader_started = 0;
+
+	// the reader is gone, count the last partial window in
+	health_tick(info, HID_get_tick(), 1);
+}
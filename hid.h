@@ -3,101 +3,280 @@
 #ifndef __HMD_HID_INFO__
 #define __HMD_HID_INFO__
 
-typedef union {
-	struct {
-		float x, y, z;
-	};
-	float arr[3];
-} vec3f;
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-typedef enum {
-	RIFT_CMD_SENSOR_CONFIG = 2,
-	RIFT_CMD_RANGE = 4,
-	RIFT_CMD_KEEP_ALIVE = 8,
-	RIFT_CMD_DISPLAY_INFO = 9,
-	RIFT_CMD_ENABLE_COMPONENTS = 0x1d
-} rift_sensor_feature_cmd;
+#include "fusion.h"
+#include "replay.h"
+#include "hist.h"
+#include "devclock.h"
+#include "cache.h"
+#include "calib.h"
+#include "magcal.h"
+#include "history.h"
+#include "backend.h"
+#include "packet.h"
+#include "pose.h"
 
-typedef enum {
-	RIFT_CF_SENSOR,
-	RIFT_CF_HMD
-} rift_coordinate_frame;
+#define MAX_PREDICTION 0.1
 
-typedef enum {
-	RIFT_IRQ_SENSORS = 1,
-	RIFT_IRQ_SENSORS_DK2 = 11
-} rift_irq_cmd;
+/* Two pose slots, like the vendor driver. The writer fills the slot readers
+   are not pointed at; seq is odd while it does. */
+typedef struct {
+	atomic_uint seq;
+	HMDPose slot[2];
+} HMDPoseBuffer;
 
-typedef enum {
-	RIFT_DT_NONE,
-	RIFT_DT_SCREEN_ONLY,
-	RIFT_DT_DISTORTION
-} rift_distortion_type;
-
-// Sensor config flags
-#define RIFT_SCF_RAW_MODE           0x01
-#define RIFT_SCF_CALIBRATION_TEST   0x02
-#define RIFT_SCF_USE_CALIBRATION    0x04
-#define RIFT_SCF_AUTO_CALIBRATION   0x08
-#define RIFT_SCF_MOTION_KEEP_ALIVE  0x10
-#define RIFT_SCF_COMMAND_KEEP_ALIVE 0x20
-#define RIFT_SCF_SENSOR_COORDINATES 0x40
+/* The seqlock behind HID_PublishPose()/HID_GetLatestPose(), usable on any
+   pose buffer including one in shared memory */
+void pose_buffer_publish(HMDPoseBuffer * buf, const HMDPose * pose);
+int pose_buffer_get(const HMDPoseBuffer * buf, HMDPose * pose);
 
 typedef struct {
-	uint16_t command_id;
-	uint16_t accel_scale;
-	uint16_t gyro_scale;
-	uint16_t mag_scale;
-} pkt_sensor_range;
+	uint64_t num_reports;
+	double latency_sum, latency_max;	// report arrival to decoded, in s
+
+	int fast_init;		// started from the cached config
+	atomic_int feature_reports;	// control transfers, from any thread
+	double first_sample;	// HID_Init*() to the first decoded report, s
+} HMDHidStats;
+
+/* Health of the link over some time. The thread handling reports counts
+   into a window of its own and publishes it each second, so nobody pays
+   for the figures but whoever asks for them with HID_GetHealth(). */
+typedef struct {
+	double start, length;	// host tick the window starts at, its length s
+	uint64_t reports;	// handled
+	uint64_t samples;	// IMU samples fused
+	uint64_t dropped;	// samples the device took that never arrived
+	uint64_t repeated;	// samples delivered again in the next report
+	uint64_t gaps;		// reports with samples missing before them
+	uint64_t timeouts;	// reader waits that saw no report
+	uint64_t decode_errors;	// reports too short or of an unknown type
+	double interval_sum, interval_max;	// between report arrivals, s
+} HMDHidHealth;
 
 typedef struct {
-	int32_t accel[3];
-	int32_t gyro[3];
-} pkt_tracker_sample;
+	atomic_uint seq;	// odd while being written
+	HMDHidHealth second, total;
+} HMDHidHealthBuffer;
+
+#define HID_BRIDGE_MAX 0.05	// default, s
+
+/* Where the time between a report becoming available and its pose being
+   published goes. On hardware a report is only seen once the read returns,
+   so HID_STAGE_READ is only meaningful for real-time replays. */
+typedef enum {
+	HID_STAGE_READ,		// report available to read returned
+	HID_STAGE_DECODE,
+	HID_STAGE_FUSE,
+	HID_STAGE_PUBLISH,
+	HID_STAGE_TOTAL,	// report available to pose published
+	HID_STAGE_INTERVAL,	// between consecutive reports becoming available
+	HID_STAGE_JITTER,	// arrival off the fitted device clock, either way
+	HID_STAGE_COUNT
+} HMDHidStage;
 
 typedef struct {
-	uint8_t num_samples;
-	uint32_t timestamp;
-	uint16_t last_command_id;
-	int16_t temperature;
-	pkt_tracker_sample samples[3];
-	int16_t mag[3];
-} pkt_tracker_sensor;
+	hmd_histogram stage[HID_STAGE_COUNT];
+	double mark;		// end of the last stage timed
+	double last_report_time;
+} HMDHidProfile;
+
+#define HID_KEEP_ALIVE_MARGIN 0.2	// default, s
 
 typedef struct {
-	uint16_t command_id;
-	uint8_t flags;
-	uint16_t packet_interval;
-	uint16_t keep_alive_interval;	// in ms
-} pkt_sensor_config;
+	uint64_t sent, failed;
+	uint64_t missed;	// sent after the device interval ran out
+	uint64_t overruns;	// timer expirations the thread slept through
+	hmd_histogram latency;	// to send one keep-alive
+	hmd_histogram lateness;	// waking up after the timer was due
+} HMDKeepAliveStats;
 
 typedef struct {
-	uint16_t command_id;
-	rift_distortion_type distortion_type;
-	uint8_t distortion_type_opts;
-	uint16_t h_resolution, v_resolution;
-	float h_screen_size, v_screen_size;
-	float v_center;
-	float lens_separation;
-	float eye_to_screen_distance[2];
-	float distortion_k[6];
-} pkt_sensor_display_info;
+	double margin;		// s left of the device interval when sending
+	double period, due;
+	int timer_fd, armed;
+	pthread_t thread;
+	int stop_fd, started;	// the scheduler thread, if we run one
+	HMDKeepAliveStats stats;
+} HMDKeepAlive;
+
+/* Where poses come from. The firmware fuses an orientation of its own;
+   taking that skips decoding the samples and the host filter, for the
+   lowest CPU cost, but leaves gyro and accel of the pose at zero. Only
+   reports of PKT_FW_QUAT_REPORT_SIZE carry it, sensor reports are fused
+   either way. */
+typedef enum {
+	HID_ORIENT_FUSION,	// host filter on every IMU sample
+	HID_ORIENT_FIRMWARE	// the firmware quaternion where a report has one
+} HMDOrientSource;
 
+#define HID_RT_PRIORITY 50	// default SCHED_FIFO priority of the reader
+
+/* Real-time reader, see HID_SetRealtime() */
 typedef struct {
-	uint16_t command_id;
-	uint16_t keep_alive_interval;
-} pkt_keep_alive;
+	int enabled;
+	int cpu;		// core the reader is pinned to, -1 for any
+	int priority;		// its SCHED_FIFO priority
+	int pinned, fifo, locked;	// what the process was allowed to do
+} HMDRealtime;
+
+struct hmd_shm;
+struct hmd_rec;
 
 typedef struct {
-	hid_device *handle;
+	const hmd_backend *backend;
+	void *dev;		// the backend's device
+	char serial[CACHE_SERIAL_MAX];	// names the per-device cache files
+	struct hmd_shm *shm;	// set when serving poses to other processes
+	struct hmd_rec *rec;	// set when recording raw reports
 	pkt_sensor_range sensor_range;
 	pkt_sensor_display_info display_info;
 	pkt_sensor_config sensor_config;
 	pkt_tracker_sensor sensor;
 	rift_coordinate_frame coordinate_frame, hw_coordinate_frame;
 	double last_keep_alive;
-	uint32_t last_imu_timestamp;
+	HMDKeepAlive keep_alive;
+	hmd_devclock clock;
 	vec3f raw_mag, raw_accel, raw_gyro;
+	HMDOrientSource orient_source;	// set before reading starts
+	gyro_calib calib;
+	mag_calib magcal;
+	fusion sensor_fusion;
+	quatf fw_orient;	// the last firmware orientation
+	uint64_t fw_time;	// its device time, in us
+	int fw_missing;		// warned that sensor reports get fused instead
+	uint16_t sample_count;	// of the last DK2 report
+	double bridge_max;	// longest gap integrated across, s; 0 never
+
+	double init_start;
+	double report_time;	// host tick the last report arrived at
+	double last_report_time;	// of the last report counted in health
+	HMDHidStats stats;
+	HMDHidHealth health;	// the window being counted
+	HMDHidHealthBuffer health_pub;
+	HMDHidProfile *profile;	// set when timing the read path stage by stage
+	HMDPoseBuffer pose;
+	hmd_pose_history history;	// every orientation, by sample time
+	hmd_pose_sample history_samples[HISTORY_SAMPLES];
+	hmd_pose_history resampled;	// see HID_SetResampleRate()
+	hmd_pose_sample resampled_samples[RESAMPLED_SAMPLES];
+	double resample_period, next_resample;
+
+	HMDRealtime realtime;
+	HMDCallbacks callbacks;
+	pthread_t reader;
+	atomic_int reader_running;
+	int reader_started;
 } HMDHidInfo;
 
+/* CLOCK_MONOTONIC in seconds, the clock all host timestamps use */
+double HID_get_tick();
+
+/* Serials of the attached headsets, at most max; -1 if hidapi fails */
+int HID_Enumerate(char serials[][CACHE_SERIAL_MAX], int max);
+
+/* Open the headset and start it. A headset seen before is put straight back
+   into its cached config; the full startup sequence of the Windows driver
+   runs for new ones and whenever that does not stick. */
+int HID_Init(HMDHidInfo * info);
+/* The same for the headset with this serial, the first one if NULL */
+int HID_InitSerial(HMDHidInfo * info, const char *serial);
+/* The same over the named backend, "hidapi" or "hidraw" */
+int HID_InitDevice(HMDHidInfo * info, const char *backend, const char *serial);
+/* Start a device some backend has opened already; takes over dev */
+int HID_InitBackend(HMDHidInfo * info, const hmd_backend * backend, void *dev);
+int HID_InitReplay(HMDHidInfo * info, const char *path, replay_mode mode);
+int HID_Close(HMDHidInfo * info);
+
+/* Link health over the last full second and since reading started, either
+   may be NULL. Returns -1 until the first second is over or the reader
+   stopped. */
+int HID_GetHealth(HMDHidInfo * info, HMDHidHealth * second,
+		  HMDHidHealth * total);
+
+/* Start recording per-stage latency histograms into info->profile, freed
+   by HID_Close() */
+int HID_EnableProfile(HMDHidInfo * info);
+
+/* Poll for one report without blocking. Returns the report size, 0 if
+   nothing was waiting and -1 on error or at the end of a replay. */
+int HID_Read(HMDHidInfo * info);
+
+/* Have HID_StartReader() run the reader real-time: pinned to cpu (-1 leaves
+   it free), at SCHED_FIFO priority, with the whole process locked in memory
+   and the reader's stack faulted in, so neither preemption by ordinary
+   threads nor page faults delay a report. Steps the process has no
+   privilege for are skipped with a warning; info->realtime tells which
+   took. Nothing on the read path allocates once HID_Init*() returned, but
+   hidapi allocates every report inside the library; hidraw does not.
+   Returns -1 for a cpu or priority that can't be. */
+int HID_SetRealtime(HMDHidInfo * info, int cpu, int priority);
+
+/* Read and decode reports on a dedicated thread that blocks on the device */
+int HID_StartReader(HMDHidInfo * info);
+int HID_ReaderRunning(HMDHidInfo * info);
+void HID_StopReader(HMDHidInfo * info);
+
+/* Send keep-alives from a timerfd driven thread, margin seconds before the
+   device's keep-alive interval runs out, so a stalled or slow reader can't
+   let the device stop. HID_StartReader() starts it with the default margin
+   unless it is already running; HID_Read() sends them inline without it. */
+int HID_StartKeepAlive(HMDHidInfo * info, double margin);
+void HID_StopKeepAlive(HMDHidInfo * info);
+
+/* Arm the keep-alive timer without a thread, for callers that wait on
+   many devices at once. Returns the timerfd; call HID_HandleKeepAlive()
+   whenever it is readable. HID_StopKeepAlive() disarms it. */
+int HID_ArmKeepAlive(HMDHidInfo * info, double margin);
+void HID_HandleKeepAlive(HMDHidInfo * info);
+
+/* Likewise for reports, instead of HID_StartReader(): the descriptor that
+   turns readable while reports wait, -1 if the backend has none (hidapi
+   and replays), and a call to handle all that wait without blocking.
+   HID_HandleReadable() returns -1 once the device is gone. */
+int HID_GetReadFd(HMDHidInfo * info);
+int HID_HandleReadable(HMDHidInfo * info);
+
+/* Copy out the most recent pose without locking. Safe to call from any
+   thread while the reader publishes; returns -1 if there is no pose yet. */
+int HID_GetLatestPose(HMDHidInfo * info, HMDPose * pose);
+
+/* Orientation expected at target_time (a HID_get_tick() value), rotating
+   the latest pose on at its angular velocity from the time its last sample
+   was taken. Predicts at most MAX_PREDICTION seconds away from it. */
+quatf HID_PredictPose(HMDHidInfo * info, double target_time);
+
+/* Orientation at time t (a HID_get_tick() value), slerped between the
+   samples taken either side of it; past the newest sample it is predicted
+   like HID_PredictPose(). Returns -1 if t is older than the history kept,
+   about a second, or nothing arrived yet. */
+int HID_GetPoseAt(HMDHidInfo * info, double t, HMDPose * pose);
+
+/* Also put out the orientation at every multiple of 1/hz seconds of host
+   time, interpolated like HID_GetPoseAt(), for consumers running at
+   display rate; 0 stops it. Call before reading starts. */
+void HID_SetResampleRate(HMDHidInfo * info, double hz);
+/* Copy the resampled poses after *cursor (0 at first) into out, at most
+   max; *cursor advances. Returns the number copied. */
+int HID_ReadResampled(HMDHidInfo * info, uint64_t * cursor, HMDPose * out,
+		      int max);
+
+/* Every pose the reader fuses, oldest first: copy those after *cursor (0 at
+   first) into out, at most max; *cursor advances. Only the orientation,
+   angular velocity and sample time are kept, the rest is zero. A consumer
+   more than HISTORY_SAMPLES behind loses the oldest. */
+int HID_ReadPoses(HMDHidInfo * info, uint64_t * cursor, HMDPose * out,
+		  int max);
+
+/* Hand every sample and pose to callbacks as well, see pose.h. Call before
+   HID_StartReader(). */
+void HID_SetCallbacks(HMDHidInfo * info, const HMDCallbacks * callbacks);
+
+/* Publish a new pose, normally done by the reader for every report. Only
+   one thread may publish at a time. */
+void HID_PublishPose(HMDHidInfo * info, const HMDPose * pose);
+
 #endif
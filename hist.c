@@ -0,0 +1,59 @@
+#include "hist.h"
+
+#define HIST_SUB (1 << HIST_SUB_BITS)
+
+static int bucket_of(uint64_t ns)
+{
+	if (ns < HIST_SUB) {
+		return ns;
+	}
+
+	int e = 63 - __builtin_clzll(ns);
+	int sub = (ns >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1);
+
+	return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+static uint64_t bucket_limit(int bucket)
+{
+	if (bucket < HIST_SUB) {
+		return bucket;
+	}
+
+	int e = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	uint64_t sub = bucket & (HIST_SUB - 1);
+
+	return ((HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_record(hmd_histogram * hist, double seconds)
+{
+	uint64_t ns = seconds > 0 ? (uint64_t) (seconds * 1e9) : 0;
+
+	hist->buckets[bucket_of(ns)]++;
+	hist->count++;
+	if (ns > hist->max) {
+		hist->max = ns;
+	}
+}
+
+double hist_percentile(const hmd_histogram * hist, double fraction)
+{
+	uint64_t rank = (uint64_t) (fraction * hist->count);
+	uint64_t seen = 0;
+
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen > rank) {
+			uint64_t limit = bucket_limit(i);
+			return (limit < hist->max ? limit : hist->max) * 1e-9;
+		}
+	}
+
+	return hist->max * 1e-9;
+}
+
+double hist_max(const hmd_histogram * hist)
+{
+	return hist->max * 1e-9;
+}
@@ -0,0 +1,25 @@
+/* Log-linear latency histogram: 16 buckets per power of two of
+   nanoseconds, so recording is a few instructions and percentiles are
+   within about 6% */
+
+#ifndef __HMD_HIST__
+#define __HMD_HIST__
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS (61 << HIST_SUB_BITS)
+
+typedef struct {
+	uint64_t count;
+	uint64_t max;		// ns
+	uint32_t buckets[HIST_BUCKETS];
+} hmd_histogram;
+
+void hist_record(hmd_histogram * hist, double seconds);
+
+/* Upper bound of the bucket holding the given fraction of samples, in s */
+double hist_percentile(const hmd_histogram * hist, double fraction);
+double hist_max(const hmd_histogram * hist);
+
+#endif
@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "history.h"
+
+void history_init(hmd_pose_history * h, hmd_pose_sample * samples,
+		  uint32_t size)
+{
+	memset(samples, 0, size * sizeof(hmd_pose_sample));
+	atomic_store(&h->head, 0);
+	h->size = size;
+	h->samples = samples;
+}
+
+void history_push(hmd_pose_history * h, double time, const quatf * orient,
+		  const vec3f * ang_vel)
+{
+	uint64_t n = atomic_load_explicit(&h->head, memory_order_relaxed);
+	hmd_pose_sample *s = &h->samples[n & (h->size - 1)];
+
+	atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	s->time = time;
+	s->orient = *orient;
+	s->ang_vel = *ang_vel;
+
+	atomic_store_explicit(&s->seq, n + 1, memory_order_release);
+	atomic_store_explicit(&h->head, n + 1, memory_order_release);
+}
+
+/* Copy of sample i, or -1 if the writer has moved past it */
+static int get(const hmd_pose_history * h, uint64_t i, hmd_pose_sample * out)
+{
+	const hmd_pose_sample *s = &h->samples[i & (h->size - 1)];
+
+	memcpy(out, s, sizeof(hmd_pose_sample));
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&s->seq, memory_order_relaxed) == i + 1
+	    && atomic_load(&out->seq) == i + 1 ? 0 : -1;
+}
+
+int history_at(const hmd_pose_history * h, double t, hmd_pose_sample * out)
+{
+	uint64_t head = atomic_load_explicit(&h->head, memory_order_acquire);
+	hmd_pose_sample a, b;
+
+	if (!head || get(h, head - 1, &b)) {
+		return -1;
+	}
+	if (t >= b.time) {
+		*out = b;
+		return t > b.time ? 1 : 0;
+	}
+
+	// keep clear of the slot the writer fills next
+	uint64_t lo = head > h->size ? head - h->size + 1 : 0, hi = head - 1;
+	if (get(h, lo, &a) || t < a.time) {
+		return -1;
+	}
+
+	// time(lo) <= t < time(hi)
+	while (hi - lo > 1) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		hmd_pose_sample m;
+
+		if (get(h, mid, &m)) {
+			return -1;
+		}
+		if (m.time <= t) {
+			lo = mid;
+			a = m;
+		} else {
+			hi = mid;
+			b = m;
+		}
+	}
+
+	float f = b.time > a.time ? (float)((t - a.time) / (b.time - a.time)) :
+	    0.0f;
+
+	out->time = t;
+	oquatf_slerp(&a.orient, &b.orient, f, &out->orient);
+	for (int i = 0; i < 3; i++) {
+		out->ang_vel.arr[i] = a.ang_vel.arr[i] +
+		    f * (b.ang_vel.arr[i] - a.ang_vel.arr[i]);
+	}
+
+	return 0;
+}
+
+int history_read(const hmd_pose_history * h, uint64_t * cursor,
+		 hmd_pose_sample * out, int max)
+{
+	uint64_t head = atomic_load_explicit(&h->head, memory_order_acquire);
+	int n = 0;
+
+	if (head - *cursor > h->size) {
+		*cursor = head - h->size;
+	}
+
+	while (*cursor < head && n < max) {
+		// a slot rewritten under us belongs to a newer lap; drop it
+		if (!get(h, *cursor, &out[n])) {
+			n++;
+		}
+		(*cursor)++;
+	}
+
+	return n;
+}
@@ -0,0 +1,48 @@
+/* The last second or so of orientations, indexed by the host tick each
+   was sampled at, so consumers can ask for the orientation at a time of
+   their choosing. One writer, any number of lock-free readers; a slot
+   carries its index + 1 once complete, like the shared memory sample ring,
+   so a reader lapped by the writer notices. */
+
+#ifndef __HMD_HISTORY__
+#define __HMD_HISTORY__
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "omath.h"
+
+#define HISTORY_SAMPLES 1024	// power of two
+#define RESAMPLED_SAMPLES 256	// power of two
+
+typedef struct {
+	atomic_ulong seq;
+	double time;		// host tick
+	quatf orient;
+	vec3f ang_vel;
+} hmd_pose_sample;
+
+typedef struct {
+	atomic_ulong head;	// samples ever pushed
+	uint32_t size;		// HISTORY_SAMPLES or RESAMPLED_SAMPLES
+	hmd_pose_sample *samples;
+} hmd_pose_history;
+
+void history_init(hmd_pose_history * h, hmd_pose_sample * samples,
+		  uint32_t size);
+
+/* Writer side, time must not go backwards */
+void history_push(hmd_pose_history * h, double time, const quatf * orient,
+		  const vec3f * ang_vel);
+
+/* The orientation at time t, slerped between the samples either side of
+   it. Returns 0, 1 with the newest sample if t is past it and -1 if t is
+   older than anything kept or there is nothing yet. */
+int history_at(const hmd_pose_history * h, double t, hmd_pose_sample * out);
+
+/* Copy the samples after *cursor into out, at most max; *cursor advances.
+   Returns the number copied, skipping ahead if the writer lapped us. */
+int history_read(const hmd_pose_history * h, uint64_t * cursor,
+		 hmd_pose_sample * out, int max);
+
+#endif
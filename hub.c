@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "hub.h"
+#include "log.h"
+
+// what an event is for: device number * 2 + one of these, which is also
+// the loop it comes in on
+#define HUB_KEEP_ALIVE 0
+#define HUB_REPORTS 1
+#define HUB_STOP UINT64_MAX
+
+static void *hub_thread(void *arg)
+{
+	hmd_hub_loop *loop = arg;
+	hmd_hub *hub = loop->hub;
+	struct epoll_event events[HUB_MAX_DEVICES + 1];
+
+	for (;;) {
+		int n = epoll_wait(loop->epoll_fd, events, HUB_MAX_DEVICES + 1,
+				   -1);
+
+		for (int i = 0; i < n; i++) {
+			uint64_t id = events[i].data.u64;
+			if (id == HUB_STOP) {
+				return NULL;
+			}
+
+			int dev = id / 2;
+			HMDHidInfo *info = hub->devices[dev];
+			if (id % 2 == HUB_REPORTS) {
+				if (HID_HandleReadable(info)) {
+					epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL,
+						  HID_GetReadFd(info), NULL);
+					atomic_store(&hub->running[dev], 0);
+				}
+			} else if (hub->polled[dev]
+				   && !atomic_load(&hub->running[dev])) {
+				// gone from the report loop; the timer is only
+				// ever touched here, so it goes here as well
+				epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL,
+					  info->keep_alive.timer_fd, NULL);
+				HID_StopKeepAlive(info);
+			} else {
+				HID_HandleKeepAlive(info);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Stop the loops started so far, and close every descriptor */
+static void hub_stop(hmd_hub * hub, int started)
+{
+	uint64_t one = 1;
+
+	if (started && write(hub->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+		LOGE("hub: could not stop the event loop");
+	}
+	for (int i = 0; i < 2; i++) {
+		if (i < started) {
+			pthread_join(hub->loops[i].thread, NULL);
+		}
+		if (hub->loops[i].epoll_fd >= 0) {
+			close(hub->loops[i].epoll_fd);
+		}
+	}
+	if (hub->stop_fd >= 0) {
+		close(hub->stop_fd);
+	}
+}
+
+hmd_hub *hub_create()
+{
+	hmd_hub *hub = calloc(1, sizeof(hmd_hub));
+	struct epoll_event ev = {.events = EPOLLIN,.data.u64 = HUB_STOP };
+	int started = 0;
+
+	if (!hub) {
+		return NULL;
+	}
+
+	hub->stop_fd = eventfd(0, EFD_CLOEXEC);
+	for (int i = 0; i < 2; i++) {
+		hub->loops[i].hub = hub;
+		hub->loops[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	}
+	for (; started < 2; started++) {
+		hmd_hub_loop *loop = &hub->loops[started];
+		if (hub->stop_fd < 0 || loop->epoll_fd < 0
+		    || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, hub->stop_fd,
+				 &ev)
+		    || pthread_create(&loop->thread, NULL, hub_thread, loop)) {
+			LOGE("hub: could not start the event loops");
+			hub_stop(hub, started);
+			free(hub);
+			return NULL;
+		}
+	}
+
+	return hub;
+}
+
+int hub_add(hmd_hub * hub, HMDHidInfo * info, double margin)
+{
+	int dev = hub->num_devices;
+	struct epoll_event ev = {.events = EPOLLIN,
+		.data.u64 = dev * 2 + HUB_KEEP_ALIVE
+	};
+	struct epoll_event rev = {.events = EPOLLIN,
+		.data.u64 = dev * 2 + HUB_REPORTS
+	};
+
+	if (dev >= HUB_MAX_DEVICES) {
+		HID_Close(info);
+		return -1;
+	}
+
+	// in place before the loop can see an event for it
+	hub->devices[dev] = info;
+	int read_fd = HID_GetReadFd(info);
+	hub->polled[dev] = read_fd >= 0;
+	atomic_store(&hub->running[dev], hub->polled[dev]);
+
+	int timers = hub->loops[HUB_KEEP_ALIVE].epoll_fd;
+	int reports = hub->loops[HUB_REPORTS].epoll_fd;
+	int fd = HID_ArmKeepAlive(info, margin);
+	if (fd < 0 || epoll_ctl(timers, EPOLL_CTL_ADD, fd, &ev)
+	    || (read_fd >= 0 ?
+		epoll_ctl(reports, EPOLL_CTL_ADD, read_fd, &rev) :
+		HID_StartReader(info))) {
+		if (fd >= 0) {
+			epoll_ctl(timers, EPOLL_CTL_DEL, fd, NULL);
+		}
+		HID_Close(info);
+		return -1;
+	}
+
+	hub->num_devices++;
+
+	return 0;
+}
+
+hmd_hub *hub_open(const char *backend, const char *const *serials, int num,
+		  double margin)
+{
+	char found[HUB_MAX_DEVICES][CACHE_SERIAL_MAX];
+	const char *all[HUB_MAX_DEVICES];
+	hmd_hub *hub;
+
+	if (!serials) {
+		num = HID_Enumerate(found, HUB_MAX_DEVICES);
+		if (num <= 0) {
+			LOGE("hub: no headsets found");
+			return NULL;
+		}
+		for (int i = 0; i < num; i++) {
+			all[i] = found[i];
+		}
+		serials = all;
+	}
+
+	if (num > HUB_MAX_DEVICES || !(hub = hub_create())) {
+		return NULL;
+	}
+
+	for (int i = 0; i < num; i++) {
+		HMDHidInfo *info = malloc(sizeof(HMDHidInfo));
+		if (!info || HID_InitDevice(info, backend, serials[i])
+		    || hub_add(hub, info, margin)) {
+			LOGE("hub: could not start headset %s", serials[i]);
+			free(info);
+			hub_close(hub);
+			return NULL;
+		}
+	}
+
+	return hub;
+}
+
+hmd_hub *hub_open_replays(const char *const *paths, int num,
+			  replay_mode mode, double margin)
+{
+	hmd_hub *hub;
+
+	if (num > HUB_MAX_DEVICES || !(hub = hub_create())) {
+		return NULL;
+	}
+
+	for (int i = 0; i < num; i++) {
+		HMDHidInfo *info = malloc(sizeof(HMDHidInfo));
+		if (!info || HID_InitReplay(info, paths[i], mode)
+		    || hub_add(hub, info, margin)) {
+			LOGE("hub: could not replay %s", paths[i]);
+			free(info);
+			hub_close(hub);
+			return NULL;
+		}
+	}
+
+	return hub;
+}
+
+int hub_running(hmd_hub * hub)
+{
+	int n = 0;
+
+	for (int i = 0; i < hub->num_devices; i++) {
+		n += (hub->polled[i] ? atomic_load(&hub->running[i]) :
+		      HID_ReaderRunning(hub->devices[i])) ? 1 : 0;
+	}
+
+	return n;
+}
+
+void hub_close(hmd_hub * hub)
+{
+	hub_stop(hub, 2);
+
+	for (int i = 0; i < hub->num_devices; i++) {
+		HID_Close(hub->devices[i]);
+		free(hub->devices[i]);
+	}
+
+	free(hub);
+}
@@ -0,0 +1,56 @@
+/* Several headsets served from one process. One epoll loop drives the
+   keep-alive timers of all of them, another reads the reports of every
+   device whose backend has a descriptor to wait on, hidraw; a keep-alive
+   blocks on a control transfer, which must not hold up the reports of the
+   others. hidapi and replays hand out no descriptor, so those devices
+   still read on a blocking reader thread each, asleep in the kernel
+   between reports. */
+
+#ifndef __HMD_HUB__
+#define __HMD_HUB__
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "hid.h"
+
+#define HUB_MAX_DEVICES 16
+
+struct hmd_hub;
+
+typedef struct {
+	struct hmd_hub *hub;
+	int epoll_fd;
+	pthread_t thread;
+} hmd_hub_loop;
+
+typedef struct hmd_hub {
+	int num_devices;
+	HMDHidInfo *devices[HUB_MAX_DEVICES];
+	int polled[HUB_MAX_DEVICES];	// read from the loop, not a thread
+	atomic_int running[HUB_MAX_DEVICES];	// of the polled ones
+	hmd_hub_loop loops[2];	// keep-alive timers, then reports
+	int stop_fd;
+} hmd_hub;
+
+/* Open and start the headsets with the given serials, or every attached
+   one if serials is NULL, over the named backend */
+hmd_hub *hub_open(const char *backend, const char *const *serials, int num,
+		  double margin);
+
+/* The same over captures or recordings, one device per file */
+hmd_hub *hub_open_replays(const char *const *paths, int num,
+			  replay_mode mode, double margin);
+
+/* An empty hub, and handing it a device opened some other way: it takes
+   the device over and starts it, closing it if that fails. The device must
+   come from malloc(), hub_close() frees it. */
+hmd_hub *hub_create();
+int hub_add(hmd_hub * hub, HMDHidInfo * info, double margin);
+
+/* Number of devices still delivering reports */
+int hub_running(hmd_hub * hub);
+
+void hub_close(hmd_hub * hub);
+
+#endif
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "log.h"
+
+static log_handler handler;
+static void *handler_user;
+
+void log_set_handler(log_handler fn, void *user)
+{
+	handler = fn;
+	handler_user = user;
+}
+
+void log_message(int level, const char *fmt, ...)
+{
+	char message[2048];
+	va_list ap;
+
+	va_start(ap, fmt);
+	//vsyslog( pri, fmt, ap );
+
+	vsnprintf(message, sizeof(message), fmt, ap);
+
+	va_end(ap);
+
+	if (handler) {
+		handler(handler_user, level, message);
+		return;
+	}
+
+	fprintf(stderr, "syslog: %s\n", message);
+}
@@ -0,0 +1,52 @@
+/* Logging with compile time levels, see LOG_LEVEL in the Makefile */
+
+#ifndef __HMD_LOG__
+#define __HMD_LOG__
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+void log_message(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Where messages go, one line each without the newline: stderr unless a
+   handler is set, and again once it is reset to NULL. Called on whichever
+   thread logs; set it before starting any. */
+typedef void (*log_handler)(void *user, int level, const char *message);
+void log_set_handler(log_handler handler, void *user);
+
+// disabled levels vanish, arguments and all
+#define LOG_NOTHING(...) do { } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOGD(...) log_message(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOGD LOG_NOTHING
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOGI(...) log_message(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOGI LOG_NOTHING
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOGW(...) log_message(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOGW LOG_NOTHING
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOGE(...) log_message(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOGE LOG_NOTHING
+#endif
+
+#endif
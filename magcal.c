@@ -0,0 +1,288 @@
+/*
+ * The ellipsoid is the quadric
+ *
+ *   A x^2 + B y^2 + C z^2 + 2D xy + 2E xz + 2F yz + 2G x + 2H y + 2I z = 1
+ *
+ * or x'Mx + 2g'x = 1, linear in theta = (A..I). Every reading far enough
+ * from the last one fitted is one recursive least squares step on theta,
+ * forgetting old readings slowly so the fit follows the headset as it gets
+ * magnetised. Centred on c = -M^-1 g the quadric reads
+ * (x - c)'M(x - c) = 1 + c'Mc = k, so sqrt(M / k) maps it onto the unit
+ * sphere. M / k is positive definite for any ellipsoid, M need not be.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "magcal.h"
+#include "cache.h"
+#include "log.h"
+
+#define MAGCAL_CACHE_MAGIC 0x47414d50	// "PMAG"
+#define MAGCAL_CACHE_VERSION 1
+
+#define MAGCAL_FORGET 0.998	// per reading fitted
+#define MAGCAL_P0 100.0		// initial variance of each parameter
+
+// fit readings at least this far apart, the field is around 0.5
+#define MAGCAL_MIN_STEP 0.05f
+
+#define MAGCAL_MIN_READINGS 50
+#define MAGCAL_MAX_SQUASH 16.0	// largest over smallest axis of M
+
+#define MAGCAL_RESIDUAL_ALPHA 0.05f	// per reading fitted
+#define MAGCAL_RESIDUAL_MAX 0.1f	// quality 0 from here on
+#define MAGCAL_MIN_QUALITY 0.9f	// to steer yaw with
+
+static float distance(const vec3f * a, const vec3f * b)
+{
+	vec3f d = { {a->x - b->x, a->y - b->y, a->z - b->z} };
+	return ovec3f_get_length(&d);
+}
+
+/* Eigenvalues l and eigenvectors, the columns of v, of the symmetric a */
+static void jacobi3(double a[3][3], double l[3], double v[3][3])
+{
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			v[i][j] = i == j;
+		}
+	}
+
+	for (int sweep = 0; sweep < 16; sweep++) {
+		double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] +
+		    a[1][2] * a[1][2];
+		if (off < 1e-18) {
+			break;
+		}
+
+		for (int p = 0; p < 2; p++) {
+			for (int q = p + 1; q < 3; q++) {
+				if (a[p][q] == 0) {
+					continue;
+				}
+				double th = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+				double t = (th >= 0 ? 1 : -1) /
+				    (fabs(th) + sqrt(th * th + 1));
+				double c = 1 / sqrt(t * t + 1), s = t * c;
+
+				for (int k = 0; k < 3; k++) {
+					double akp = a[k][p], akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for (int k = 0; k < 3; k++) {
+					double apk = a[p][k], aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for (int k = 0; k < 3; k++) {
+					double vkp = v[k][p], vkq = v[k][q];
+					v[k][p] = c * vkp - s * vkq;
+					v[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < 3; i++) {
+		l[i] = a[i][i];
+	}
+}
+
+/* center and soft from theta; valid only for a plausible ellipsoid */
+static void derive(mag_calib * c)
+{
+	const double *t = c->state.theta;
+	double m[3][3] = { {t[0], t[3], t[4]}, {t[3], t[1], t[5]},
+	{t[4], t[5], t[2]}
+	};
+	double l[3], v[3][3], e[3][3];
+
+	c->valid = 0;
+	if (c->state.accepted < MAGCAL_MIN_READINGS) {
+		return;
+	}
+
+	memcpy(e, m, sizeof(e));
+	jacobi3(e, l, v);
+
+	// c = -M^-1 g = -V diag(1/l) V' g
+	double center[3], k = 1;
+	for (int i = 0; i < 3; i++) {
+		center[i] = 0;
+	}
+	for (int j = 0; j < 3; j++) {
+		double vg = v[0][j] * t[6] + v[1][j] * t[7] + v[2][j] * t[8];
+		for (int i = 0; i < 3; i++) {
+			center[i] -= v[i][j] * vg / l[j];
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			k += center[i] * m[i][j] * center[j];
+		}
+	}
+
+	// M and k flip sign together when the origin is outside the ellipsoid
+	for (int i = 0; i < 3; i++) {
+		l[i] /= k;
+	}
+	double lmin = fmin(l[0], fmin(l[1], l[2]));
+	double lmax = fmax(l[0], fmax(l[1], l[2]));
+	if (!(lmin > 0) || !(lmax < MAGCAL_MAX_SQUASH * lmin)) {
+		return;
+	}
+
+	// soft = V diag(sqrt(l)) V', l divided by k already
+	for (int i = 0; i < 3; i++) {
+		c->center.arr[i] = (float)center[i];
+		for (int j = 0; j < 3; j++) {
+			double s = 0;
+			for (int n = 0; n < 3; n++) {
+				s += v[i][n] * sqrt(l[n]) * v[j][n];
+			}
+			c->soft[i][j] = (float)s;
+		}
+	}
+
+	c->valid = 1;
+}
+
+static void correct(const mag_calib * c, const vec3f * mag, vec3f * out)
+{
+	vec3f d = { {mag->x - c->center.x, mag->y - c->center.y,
+		     mag->z - c->center.z} };
+
+	for (int i = 0; i < 3; i++) {
+		out->arr[i] = c->soft[i][0] * d.x + c->soft[i][1] * d.y +
+		    c->soft[i][2] * d.z;
+	}
+}
+
+static void fit(mag_calib * c, const vec3f * mag)
+{
+	mag_calib_state *s = &c->state;
+	double x = mag->x, y = mag->y, z = mag->z;
+	double h[MAGCAL_PARAMS] = { x * x, y * y, z * z, 2 * x * y, 2 * x * z,
+		2 * y * z, 2 * x, 2 * y, 2 * z
+	};
+	double ph[MAGCAL_PARAMS], denom = MAGCAL_FORGET, err = 1;
+
+	for (int i = 0; i < MAGCAL_PARAMS; i++) {
+		ph[i] = 0;
+		for (int j = 0; j < MAGCAL_PARAMS; j++) {
+			ph[i] += s->p[i][j] * h[j];
+		}
+		denom += h[i] * ph[i];
+		err -= h[i] * s->theta[i];
+	}
+
+	// theta += P h e / (lambda + h'P h), P = (P - P h h'P / (...)) / lambda
+	for (int i = 0; i < MAGCAL_PARAMS; i++) {
+		s->theta[i] += ph[i] * err / denom;
+		for (int j = 0; j < MAGCAL_PARAMS; j++) {
+			s->p[i][j] = (s->p[i][j] - ph[i] * ph[j] / denom) /
+			    MAGCAL_FORGET;
+		}
+	}
+
+	s->accepted++;
+	c->last = *mag;
+	c->dirty = 1;
+	derive(c);
+}
+
+void magcal_init(mag_calib * c)
+{
+	memset(c, 0, sizeof(mag_calib));
+	for (int i = 0; i < MAGCAL_PARAMS; i++) {
+		c->state.p[i][i] = MAGCAL_P0;
+	}
+	c->residual = MAGCAL_RESIDUAL_MAX;
+}
+
+int magcal_load(mag_calib * c, const char *serial)
+{
+	mag_calib_state state;
+
+	if (cache_load(serial, "mag", MAGCAL_CACHE_MAGIC,
+		       MAGCAL_CACHE_VERSION, &state, sizeof(state))) {
+		return -1;
+	}
+
+	c->state = state;
+	c->residual = MAGCAL_RESIDUAL_MAX;
+	c->dirty = 0;
+	derive(c);
+
+	return 0;
+}
+
+int magcal_store(mag_calib * c, const char *serial)
+{
+	if (cache_store(serial, "mag", MAGCAL_CACHE_MAGIC,
+			MAGCAL_CACHE_VERSION, &c->state, sizeof(c->state))) {
+		return -1;
+	}
+
+	c->dirty = 0;
+
+	return 0;
+}
+
+int magcal_update(mag_calib * c, const vec3f * mag, vec3f * out)
+{
+	if (distance(mag, &c->last) > MAGCAL_MIN_STEP) {
+		int was_valid = c->valid;
+
+		// judge the fit by readings it has not seen yet, so a fit of
+		// one patch of the sphere does not pass for a good one
+		if (c->valid) {
+			correct(c, mag, out);
+			float len = ovec3f_get_length(out);
+			c->residual += MAGCAL_RESIDUAL_ALPHA *
+			    (fminf(fabsf(len - 1.0f), 1.0f) - c->residual);
+		}
+
+		fit(c, mag);
+		if (c->valid && !was_valid) {
+			LOGI("magcal: fit center %f %f %f", c->center.x,
+			     c->center.y, c->center.z);
+		}
+	}
+
+	if (!c->valid) {
+		return 0;
+	}
+
+	correct(c, mag, out);
+
+	float a[3] = { fabsf(out->x), fabsf(out->y), fabsf(out->z) };
+	int axis = a[0] > a[1] ? (a[0] > a[2] ? 0 : 2) : (a[1] > a[2] ? 1 : 2);
+	c->state.seen |= 1u << (axis * 2 + (out->arr[axis] < 0));
+
+	float len = ovec3f_get_length(out);
+	if (len == 0 || magcal_quality(c) < MAGCAL_MIN_QUALITY) {
+		return 0;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		out->arr[i] /= len;
+	}
+
+	return 1;
+}
+
+float magcal_quality(const mag_calib * c)
+{
+	if (!c->valid) {
+		return 0;
+	}
+
+	float fit = 1.0f - c->residual / MAGCAL_RESIDUAL_MAX;
+	float coverage = (float)__builtin_popcount(c->state.seen) /
+	    MAGCAL_DIRECTIONS;
+
+	return fit > 0 ? fit * coverage : 0;
+}
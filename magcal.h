@@ -0,0 +1,47 @@
+/* Magnetometer hard and soft iron calibration. Readings of a calibrated
+   magnetometer lie on a sphere; the headset's own iron shifts and squashes
+   that into an ellipsoid. Its quadric is fitted by recursive least squares,
+   a fixed amount of work per reading, over readings spread around it. */
+
+#ifndef __HMD_MAGCAL__
+#define __HMD_MAGCAL__
+
+#include <stdint.h>
+
+#include "omath.h"
+
+#define MAGCAL_PARAMS 9
+#define MAGCAL_DIRECTIONS 6	// +-x, +-y, +-z of the centred field
+
+/* What the cache holds: the fit itself, so it goes on learning */
+typedef struct {
+	double theta[MAGCAL_PARAMS];	// quadric, see magcal.c
+	double p[MAGCAL_PARAMS][MAGCAL_PARAMS];	// its inverse information
+	uint32_t accepted;	// readings fitted
+	uint32_t seen;		// MAGCAL_DIRECTIONS bits
+} mag_calib_state;
+
+typedef struct {
+	mag_calib_state state;
+	vec3f last;		// reading last fitted
+	vec3f center;		// hard iron offset
+	float soft[3][3];	// soft iron correction onto the unit sphere
+	int valid;		// center and soft describe an ellipsoid
+	float residual;		// mean | |corrected| - 1 | of new readings
+	int dirty;		// fitted something since the last load or store
+} mag_calib;
+
+void magcal_init(mag_calib * c);
+
+/* Returns 0 if the fit of this serial was restored, -1 otherwise */
+int magcal_load(mag_calib * c, const char *serial);
+int magcal_store(mag_calib * c, const char *serial);
+
+/* Feed one reading. Returns 1 and the corrected field, unit length, in out
+   once the fit is good enough to steer yaw with, 0 otherwise. */
+int magcal_update(mag_calib * c, const vec3f * mag, vec3f * out);
+
+/* 0 to 1: how much of the sphere was seen times how well readings fit it */
+float magcal_quality(const mag_calib * c);
+
+#endif
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "hid.h"
+#include "shm.h"
+#include "hub.h"
+#include "rec.h"
+#include "trace.h"
+
+#define REC_DEFAULT_SECONDS 3600
+#define REC_REPORTS_PER_SECOND 1000
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t] [-d | -c] [-n name] [-w file [-W seconds]] [-k ms] [-q] [-R cpu] [-b backend] [-l | -a | -s serial... | -r capture [-f]]\n", name);
+	fprintf(stderr, "  -r file  replay a USBPcap capture or a recording instead of the headset\n");
+	fprintf(stderr, "  -f       replay as fast as possible, not in real time\n");
+	fprintf(stderr, "  -b name  talk to headsets through hidapi (default) or hidraw\n");
+	fprintf(stderr, "  -l       list attached headsets\n");
+	fprintf(stderr, "  -a       serve every attached headset\n");
+	fprintf(stderr, "  -s serial  open this headset; more than one serves them all\n");
+	fprintf(stderr, "  -t       trace every report to stderr\n");
+	fprintf(stderr, "  -d       serve poses and samples in shared memory\n");
+	fprintf(stderr, "  -c       consume from shared memory, reporting wake-up latency\n");
+	fprintf(stderr, "  -n name  shared memory name (default %s)\n", SHM_DEFAULT_NAME);
+	fprintf(stderr, "  -w file  record every raw report to file\n");
+	fprintf(stderr, "  -W secs  room to reserve in the recording (default %d)\n", REC_DEFAULT_SECONDS);
+	fprintf(stderr, "  -q       take the firmware's orientation from reports that carry it\n");
+	fprintf(stderr, "  -R cpu   read real-time: SCHED_FIFO, pinned to cpu (-1: any), memory locked\n");
+	fprintf(stderr, "  -k ms    send keep-alives this long before they run out (default %.0f)\n", HID_KEEP_ALIVE_MARGIN * 1000);
+}
+
+/* Wake up on every report the server publishes and measure how long after
+   the report arrived at the server the consumer got to look at it */
+static int run_consumer(const char *name)
+{
+	hmd_shm *shm = shm_client_open(name);
+	if (!shm) {
+		return 1;
+	}
+
+	unsigned seq = shm_client_wait(shm, 0, 0);
+	uint64_t cursor = atomic_load(&shm->region->sample_head);
+	shm_sample samples[64];
+	double last_print = HID_get_tick();
+	unsigned long wakes = 0, num_samples = 0;
+	double latency_sum = 0, latency_max = 0;
+	HMDPose pose;
+
+	while (!stop) {
+		unsigned now = shm_client_wait(shm, seq, 1000);
+		double t = HID_get_tick();
+
+		if (now != seq && !shm_client_get_pose(shm, &pose)) {
+			double latency = t - pose.host_time;
+			latency_sum += latency;
+			if (latency > latency_max) {
+				latency_max = latency;
+			}
+			wakes++;
+		}
+		seq = now;
+
+		int n;
+		while ((n = shm_client_read_samples(shm, &cursor, samples, 64))) {
+			num_samples += n;
+		}
+
+		if (t - last_print >= 1.0) {
+			printf("%lu wake-ups, %lu samples, report to wake-up "
+			       "mean %.1f us max %.1f us\n", wakes, num_samples,
+			       wakes ? latency_sum / wakes * 1e6 : 0.0,
+			       latency_max * 1e6);
+			fflush(stdout);
+			wakes = num_samples = 0;
+			latency_sum = latency_max = 0;
+			last_print = t;
+		}
+	}
+
+	shm_close(shm);
+
+	return 0;
+}
+
+static void print_device(const HMDHidInfo * info)
+{
+	const HMDHidStats *stats = &info->stats;
+
+	printf("%-16s %8llu reports  latency mean %7.1f us  max %8.1f us  "
+	       "%llu keep-alives missed\n", info->serial,
+	       (unsigned long long)stats->num_reports,
+	       stats->num_reports ?
+	       stats->latency_sum / stats->num_reports * 1e6 : 0.0,
+	       stats->latency_max * 1e6,
+	       (unsigned long long)info->keep_alive.stats.missed);
+}
+
+static int run_hub(const char *backend, const char *const *serials, int num,
+		   double margin)
+{
+	hmd_hub *hub = hub_open(backend, num ? serials : NULL, num, margin);
+	if (!hub) {
+		return 1;
+	}
+
+	while (hub_running(hub) && !stop) {
+		usleep(100000);
+	}
+
+	for (int i = 0; i < hub->num_devices; i++) {
+		print_device(hub->devices[i]);
+	}
+	hub_close(hub);
+
+	return 0;
+}
+
+static int list_headsets()
+{
+	char serials[HUB_MAX_DEVICES][CACHE_SERIAL_MAX];
+	int n = HID_Enumerate(serials, HUB_MAX_DEVICES);
+
+	for (int i = 0; i < n; i++) {
+		printf("%s\n", serials[i]);
+	}
+
+	return n < 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	HMDHidInfo info;
+	const char *replay_file = NULL;
+	const char *shm_name = SHM_DEFAULT_NAME;
+	const char *rec_file = NULL;
+	const char *backend = "hidapi";
+	double rec_seconds = REC_DEFAULT_SECONDS;
+	double keep_alive_margin = HID_KEEP_ALIVE_MARGIN;
+	const char *serials[HUB_MAX_DEVICES];
+	replay_mode mode = REPLAY_REALTIME;
+	int opt, trace = 0, daemon = 0, consumer = 0, all = 0, num_serials = 0;
+	int firmware = 0, realtime = 0, rt_cpu = -1;
+
+	while ((opt = getopt(argc, argv, "r:ftdcn:w:W:k:qR:las:b:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			replay_file = optarg;
+			break;
+		case 'f':
+			mode = REPLAY_FAST;
+			break;
+		case 't':
+			trace = 1;
+			break;
+		case 'd':
+			daemon = 1;
+			break;
+		case 'c':
+			consumer = 1;
+			break;
+		case 'n':
+			shm_name = optarg;
+			break;
+		case 'w':
+			rec_file = optarg;
+			break;
+		case 'W':
+			rec_seconds = atof(optarg);
+			break;
+		case 'k':
+			keep_alive_margin = atof(optarg) / 1000.0;
+			break;
+		case 'q':
+			firmware = 1;
+			break;
+		case 'R':
+			realtime = 1;
+			rt_cpu = atoi(optarg);
+			break;
+		case 'l':
+			return list_headsets();
+		case 'a':
+			all = 1;
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		case 's':
+			if (num_serials < HUB_MAX_DEVICES) {
+				serials[num_serials++] = optarg;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	if (consumer) {
+		return run_consumer(shm_name);
+	}
+
+	if (all || num_serials > 1) {
+		if (replay_file || daemon || rec_file || realtime) {
+			fprintf(stderr, "-r, -d, -w and -R take a single headset\n");
+			return 1;
+		}
+		return run_hub(backend, serials, all ? 0 : num_serials,
+			       keep_alive_margin);
+	}
+
+	if (trace) {
+		trace_start(stderr);
+	}
+
+	if (replay_file) {
+		if (HID_InitReplay(&info, replay_file, mode)) {
+			return 1;
+		}
+	} else if (HID_InitDevice(&info, backend,
+				  num_serials ? serials[0] : NULL)) {
+		return 1;
+	}
+
+	if (firmware) {
+		info.orient_source = HID_ORIENT_FIRMWARE;
+	}
+
+	if (realtime && HID_SetRealtime(&info, rt_cpu, HID_RT_PRIORITY)) {
+		HID_Close(&info);
+		return 1;
+	}
+
+	if (daemon && !(info.shm = shm_server_open(shm_name))) {
+		HID_Close(&info);
+		return 1;
+	}
+
+	if (rec_file && !(info.rec = rec_create(rec_file,
+						rec_seconds *
+						REC_REPORTS_PER_SECOND))) {
+		HID_Close(&info);
+		return 1;
+	}
+
+	if (HID_StartKeepAlive(&info, keep_alive_margin)
+	    || HID_StartReader(&info)) {
+		HID_Close(&info);
+		return 1;
+	}
+
+	// the reader thread only stops on a device error or the end of a replay
+	while (HID_ReaderRunning(&info) && !stop) {
+		usleep(100000);
+	}
+
+	HID_Close(&info);
+	if (info.stats.num_reports) {
+		fprintf(stderr, "init: %s, %d feature reports, first sample "
+			"after %.1f ms\n", info.stats.fast_init ?
+			"cached config" : "full sequence",
+			atomic_load(&info.stats.feature_reports),
+			info.stats.first_sample * 1e3);
+	}
+	HMDKeepAliveStats *ka = &info.keep_alive.stats;
+	fprintf(stderr, "keep-alive: %llu sent, %llu failed, %llu missed, "
+		"%llu overruns, send p99 %.2f ms, wake-up p99 %.2f ms\n",
+		(unsigned long long)ka->sent, (unsigned long long)ka->failed,
+		(unsigned long long)ka->missed,
+		(unsigned long long)ka->overruns,
+		hist_percentile(&ka->latency, 0.99) * 1e3,
+		hist_percentile(&ka->lateness, 0.99) * 1e3);
+	HMDHidHealth health;
+	if (!HID_GetHealth(&info, NULL, &health)) {
+		fprintf(stderr, "health: %llu samples, %llu dropped in %llu "
+			"gaps, %llu repeated, %llu read timeouts, %llu bad "
+			"reports, report interval max %.1f ms\n",
+			(unsigned long long)health.samples,
+			(unsigned long long)health.dropped,
+			(unsigned long long)health.gaps,
+			(unsigned long long)health.repeated,
+			(unsigned long long)health.timeouts,
+			(unsigned long long)health.decode_errors,
+			health.interval_max * 1e3);
+	}
+	if (info.shm) {
+		shm_close(info.shm);
+	}
+	if (info.rec) {
+		fprintf(stderr, "recorded %llu reports to %s\n",
+			(unsigned long long)rec_count(info.rec), rec_file);
+		rec_close(info.rec);
+	}
+
+	trace_stop();
+	if (trace_dropped()) {
+		fprintf(stderr, "trace: %lu events dropped\n", trace_dropped());
+	}
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <math.h>
+
+#include "omath.h"
+
+float ovec3f_get_length(const vec3f * me)
+{
+	return sqrtf(me->x * me->x + me->y * me->y + me->z * me->z);
+}
+
+void ovec3f_normalize_me(vec3f * me)
+{
+	if (me->x == 0 && me->y == 0 && me->z == 0)
+		return;
+
+	float len = ovec3f_get_length(me);
+	me->x /= len;
+	me->y /= len;
+	me->z /= len;
+}
+
+void ovec3f_cross(const vec3f * a, const vec3f * b, vec3f * out)
+{
+	out->x = a->y * b->z - a->z * b->y;
+	out->y = a->z * b->x - a->x * b->z;
+	out->z = a->x * b->y - a->y * b->x;
+}
+
+void oquatf_init_axis(quatf * me, const vec3f * vec, float angle)
+{
+	vec3f norm = *vec;
+	ovec3f_normalize_me(&norm);
+
+	me->x = norm.x * sinf(angle / 2.0f);
+	me->y = norm.y * sinf(angle / 2.0f);
+	me->z = norm.z * sinf(angle / 2.0f);
+	me->w = cosf(angle / 2.0f);
+}
+
+void oquatf_mult(const quatf * me, const quatf * q, quatf * out)
+{
+	quatf r;
+
+	r.x = me->w * q->x + me->x * q->w + me->y * q->z - me->z * q->y;
+	r.y = me->w * q->y - me->x * q->z + me->y * q->w + me->z * q->x;
+	r.z = me->w * q->z + me->x * q->y - me->y * q->x + me->z * q->w;
+	r.w = me->w * q->w - me->x * q->x - me->y * q->y - me->z * q->z;
+
+	*out = r;
+}
+
+void oquatf_normalize_me(quatf * me)
+{
+	float len = sqrtf(me->x * me->x + me->y * me->y + me->z * me->z +
+			  me->w * me->w);
+	if (len == 0)
+		return;
+
+	me->x /= len;
+	me->y /= len;
+	me->z /= len;
+	me->w /= len;
+}
+
+void oquatf_get_rotated(const quatf * me, const vec3f * vec, vec3f * out_vec)
+{
+	quatf q = { {vec->x * me->w + vec->z * me->y - vec->y * me->z,
+		     vec->y * me->w + vec->x * me->z - vec->z * me->x,
+		     vec->z * me->w + vec->y * me->x - vec->x * me->y,
+		     vec->x * me->x + vec->y * me->y + vec->z * me->z}
+	};
+
+	out_vec->x = me->w * q.x + me->x * q.w + me->y * q.z - me->z * q.y;
+	out_vec->y = me->w * q.y + me->y * q.w + me->z * q.x - me->x * q.z;
+	out_vec->z = me->w * q.z + me->z * q.w + me->x * q.y - me->y * q.x;
+}
+
+void oquatf_slerp(const quatf * a, const quatf * b, float t, quatf * out)
+{
+	float d = a->x * b->x + a->y * b->y + a->z * b->z + a->w * b->w;
+	float sign = d < 0 ? -1.0f : 1.0f;
+	float wa = 1.0f - t, wb = t * sign;
+
+	d *= sign;
+
+	// close quaternions would divide by almost nothing, lerp them
+	if (d < 0.9995f) {
+		float angle = acosf(d);
+		float s = 1.0f / sinf(angle);
+		wa = sinf(wa * angle) * s;
+		wb = sinf(t * angle) * s * sign;
+	}
+
+	out->x = wa * a->x + wb * b->x;
+	out->y = wa * a->y + wb * b->y;
+	out->z = wa * a->z + wb * b->z;
+	out->w = wa * a->w + wb * b->w;
+	oquatf_normalize_me(out);
+}
@@ -0,0 +1,30 @@
+/* From OpenHMD math helpers */
+
+#ifndef __HMD_OMATH__
+#define __HMD_OMATH__
+
+typedef union {
+	struct {
+		float x, y, z;
+	};
+	float arr[3];
+} vec3f;
+
+typedef union {
+	struct {
+		float x, y, z, w;
+	};
+	float arr[4];
+} quatf;
+
+float ovec3f_get_length(const vec3f * me);
+void ovec3f_normalize_me(vec3f * me);
+void ovec3f_cross(const vec3f * a, const vec3f * b, vec3f * out);
+
+void oquatf_init_axis(quatf * me, const vec3f * vec, float angle);
+void oquatf_mult(const quatf * me, const quatf * q, quatf * out);
+void oquatf_normalize_me(quatf * me);
+void oquatf_get_rotated(const quatf * me, const vec3f * vec, vec3f * out_vec);
+void oquatf_slerp(const quatf * a, const quatf * b, float t, quatf * out);
+
+#endif
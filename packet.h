@@ -0,0 +1,321 @@
+/*
+ * Report layouts, each described once as a table of
+ *
+ *   F(x, field, offset, kind)                    scalar
+ *   A(x, field, offset, kind, count, stride)     array
+ *
+ * entries. PKT_LAYOUT() turns a table into a bounds-checked decoder that
+ * reads every field at a fixed offset after a single size check, plus
+ * accessors reading scalar fields straight out of a receive buffer;
+ * PKT_ENCODER() adds the matching encoder. Every field is checked against
+ * the report size at compile time.
+ */
+
+#ifndef __HMD_PACKET__
+#define __HMD_PACKET__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "decode.h"
+
+typedef enum {
+	RIFT_CMD_SENSOR_CONFIG = 2,
+	RIFT_CMD_RANGE = 4,
+	RIFT_CMD_KEEP_ALIVE = 8,
+	RIFT_CMD_DISPLAY_INFO = 9,
+	RIFT_CMD_ENABLE_COMPONENTS = 0x1d,
+	PIMAX_CMD_KEEP_ALIVE = 0x11
+} rift_sensor_feature_cmd;
+
+typedef enum {
+	RIFT_CF_SENSOR,
+	RIFT_CF_HMD
+} rift_coordinate_frame;
+
+typedef enum {
+	RIFT_IRQ_SENSORS = 1,
+	RIFT_IRQ_SENSORS_DK2 = 11
+} rift_irq_cmd;
+
+typedef enum {
+	RIFT_DT_NONE,
+	RIFT_DT_SCREEN_ONLY,
+	RIFT_DT_DISTORTION
+} rift_distortion_type;
+
+// Sensor config flags
+#define RIFT_SCF_RAW_MODE           0x01
+#define RIFT_SCF_CALIBRATION_TEST   0x02
+#define RIFT_SCF_USE_CALIBRATION    0x04
+#define RIFT_SCF_AUTO_CALIBRATION   0x08
+#define RIFT_SCF_MOTION_KEEP_ALIVE  0x10
+#define RIFT_SCF_COMMAND_KEEP_ALIVE 0x20
+#define RIFT_SCF_SENSOR_COORDINATES 0x40
+
+typedef struct {
+	uint16_t command_id;
+	uint16_t accel_scale;
+	uint16_t gyro_scale;
+	uint16_t mag_scale;
+} pkt_sensor_range;
+
+typedef struct {
+	int32_t accel[3];
+	int32_t gyro[3];
+} pkt_tracker_sample;
+
+typedef struct {
+	uint8_t num_samples;
+	uint16_t sample_count;	// DK2: samples taken since start, wraps
+	uint32_t timestamp;
+	uint16_t last_command_id;
+	int16_t temperature;
+	pkt_tracker_sample samples[3];
+	int16_t mag[3];
+} pkt_tracker_sensor;
+
+typedef struct {
+	uint16_t command_id;
+	uint8_t flags;
+	uint16_t packet_interval;
+	uint16_t keep_alive_interval;	// in ms
+} pkt_sensor_config;
+
+typedef struct {
+	uint16_t command_id;
+	rift_distortion_type distortion_type;
+	uint8_t distortion_type_opts;
+	uint16_t h_resolution, v_resolution;
+	float h_screen_size, v_screen_size;
+	float v_center;
+	float lens_separation;
+	float eye_to_screen_distance[2];
+	float distortion_k[6];
+} pkt_sensor_display_info;
+
+typedef struct {
+	uint16_t command_id;
+	uint16_t keep_alive_interval;
+} pkt_keep_alive;
+
+// The firmware's own orientation, see decode_fw_quat()
+typedef struct {
+	uint32_t timestamp;
+	int16_t quat[4];
+} pkt_fw_quat;
+
+// Pimax keep-alive, report 17: keeps the given input report streaming
+typedef struct {
+	uint16_t command_id;
+	uint8_t report;
+	uint16_t keep_alive_interval;	// in ms
+} pkt_pimax_keep_alive;
+
+
+// Field kinds: C type, width in bytes, load and store (little endian)
+#define PKT_U8_TYPE uint8_t
+#define PKT_U8_WIDTH 1
+#define PKT_U8_LOAD(b) ((uint8_t)(b)[0])
+#define PKT_U8_STORE(b, v) ((b)[0] = (uint8_t)(v))
+
+#define PKT_U16_TYPE uint16_t
+#define PKT_U16_WIDTH 2
+#define PKT_U16_LOAD(b) ((uint16_t)((b)[0] | (b)[1] << 8))
+#define PKT_U16_STORE(b, v) ((b)[0] = (uint8_t)(v), (b)[1] = (uint8_t)((v) >> 8))
+
+#define PKT_S16_TYPE int16_t
+#define PKT_S16_WIDTH 2
+#define PKT_S16_LOAD(b) ((int16_t)PKT_U16_LOAD(b))
+#define PKT_S16_STORE(b, v) PKT_U16_STORE(b, (uint16_t)(v))
+
+#define PKT_U32_TYPE uint32_t
+#define PKT_U32_WIDTH 4
+#define PKT_U32_LOAD(b) ((uint32_t)(b)[0] | (uint32_t)(b)[1] << 8 | \
+			 (uint32_t)(b)[2] << 16 | (uint32_t)(b)[3] << 24)
+#define PKT_U32_STORE(b, v) (PKT_U16_STORE(b, (uint32_t)(v)), \
+			     PKT_U16_STORE((b) + 2, (uint32_t)(v) >> 16))
+
+// signed micro units
+#define PKT_FIXED_TYPE float
+#define PKT_FIXED_WIDTH 4
+#define PKT_FIXED_LOAD(b) ((float)(int32_t)PKT_U32_LOAD(b) / 1000000.0f)
+#define PKT_FIXED_STORE(b, v) PKT_U32_STORE(b, (int32_t)((v) * 1000000.0f))
+
+#define PKT_FLOAT_TYPE float
+#define PKT_FLOAT_WIDTH 4
+#define PKT_FLOAT_LOAD(b) pkt_load_float(b)
+#define PKT_FLOAT_STORE(b, v) pkt_store_float(b, v)
+
+// one accelerometer and one gyro sample, see decode_sample()
+#define PKT_IMU_WIDTH 16
+#define PKT_IMU_DECODE(dst, b) (decode_sample(b, (dst).accel), \
+				decode_sample((b) + 8, (dst).gyro))
+
+#define PKT_U8_DECODE(dst, b) ((dst) = PKT_U8_LOAD(b))
+#define PKT_U16_DECODE(dst, b) ((dst) = PKT_U16_LOAD(b))
+#define PKT_S16_DECODE(dst, b) ((dst) = PKT_S16_LOAD(b))
+#define PKT_U32_DECODE(dst, b) ((dst) = PKT_U32_LOAD(b))
+#define PKT_FIXED_DECODE(dst, b) ((dst) = PKT_FIXED_LOAD(b))
+#define PKT_FLOAT_DECODE(dst, b) ((dst) = PKT_FLOAT_LOAD(b))
+
+static inline float pkt_load_float(const unsigned char *b)
+{
+	uint32_t v = PKT_U32_LOAD(b);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static inline void pkt_store_float(unsigned char *b, float f)
+{
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	PKT_U32_STORE(b, v);
+}
+
+// table callbacks, x is the size, the struct or the name prefix
+#define PKT_CHECK_F(size, field, off, kind) \
+	_Static_assert((off) + PKT_##kind##_WIDTH <= (size), \
+		       #field " runs past the end of the report");
+#define PKT_CHECK_A(size, field, off, kind, n, stride) \
+	_Static_assert((off) + ((n) - 1) * (stride) + PKT_##kind##_WIDTH <= \
+		       (size), #field " runs past the end of the report");
+
+#define PKT_DECODE_F(p, field, off, kind) \
+	PKT_##kind##_DECODE((p)->field, buf + (off));
+#define PKT_DECODE_A(p, field, off, kind, n, stride) \
+	for (int i_ = 0; i_ < (n); i_++) { \
+		PKT_##kind##_DECODE((p)->field[i_], buf + (off) + i_ * (stride)); \
+	}
+
+#define PKT_ENCODE_F(p, field, off, kind) \
+	PKT_##kind##_STORE(buf + (off), (p)->field);
+#define PKT_ENCODE_A(p, field, off, kind, n, stride) \
+	for (int i_ = 0; i_ < (n); i_++) { \
+		PKT_##kind##_STORE(buf + (off) + i_ * (stride), (p)->field[i_]); \
+	}
+
+#define PKT_VIEW_F(prefix, field, off, kind) \
+	static inline PKT_##kind##_TYPE prefix##_##field(const unsigned char *buf) \
+	{ \
+		return PKT_##kind##_LOAD(buf + (off)); \
+	}
+#define PKT_VIEW_A(prefix, field, off, kind, n, stride)
+
+/* prefix_decode(p, buf, size) returns 0 if size is short of the layout,
+   prefix_<field>(buf) reads one scalar field of a checked buffer */
+#define PKT_LAYOUT(prefix, type, TABLE, size) \
+	TABLE(PKT_CHECK_F, PKT_CHECK_A, size) \
+	TABLE(PKT_VIEW_F, PKT_VIEW_A, prefix) \
+	static inline int prefix##_decode(type *p, const unsigned char *buf, \
+					  int len) \
+	{ \
+		if (len < (size)) { \
+			return 0; \
+		} \
+		TABLE(PKT_DECODE_F, PKT_DECODE_A, p) \
+		return 1; \
+	}
+
+/* prefix_encode(p, buf) writes the report id and every field, returning
+   the report size; buf needs room for size bytes */
+#define PKT_ENCODER(prefix, type, TABLE, id, size) \
+	static inline int prefix##_encode(const type *p, unsigned char *buf) \
+	{ \
+		memset(buf, 0, (size)); \
+		buf[0] = (id); \
+		TABLE(PKT_ENCODE_F, PKT_ENCODE_A, p) \
+		return (size); \
+	}
+
+#define PKT_SENSOR_RANGE_SIZE 8
+#define PKT_SENSOR_RANGE(F, A, x) \
+	F(x, command_id, 1, U16) \
+	F(x, accel_scale, 3, U8) \
+	F(x, gyro_scale, 4, U16) \
+	F(x, mag_scale, 6, U16)
+
+#define PKT_SENSOR_CONFIG_SIZE 7
+#define PKT_SENSOR_CONFIG(F, A, x) \
+	F(x, command_id, 1, U16) \
+	F(x, flags, 3, U8) \
+	F(x, packet_interval, 4, U8) \
+	F(x, keep_alive_interval, 5, U16)
+
+#define PKT_DISPLAY_INFO_SIZE 56
+#define PKT_DISPLAY_INFO(F, A, x) \
+	F(x, command_id, 1, U16) \
+	F(x, distortion_type, 3, U8) \
+	F(x, h_resolution, 4, U16) \
+	F(x, v_resolution, 6, U16) \
+	F(x, h_screen_size, 8, FIXED) \
+	F(x, v_screen_size, 12, FIXED) \
+	F(x, v_center, 16, FIXED) \
+	F(x, lens_separation, 20, FIXED) \
+	A(x, eye_to_screen_distance, 24, FIXED, 2, 4) \
+	A(x, distortion_k, 32, FLOAT, 6, 4)
+
+#define PKT_KEEP_ALIVE_SIZE 5
+#define PKT_KEEP_ALIVE(F, A, x) \
+	F(x, command_id, 1, U16) \
+	F(x, keep_alive_interval, 3, U16)
+
+#define PKT_PIMAX_KEEP_ALIVE_SIZE 6
+#define PKT_PIMAX_KEEP_ALIVE(F, A, x) \
+	F(x, command_id, 1, U16) \
+	F(x, report, 3, U8) \
+	F(x, keep_alive_interval, 4, U16)
+
+// DK1 timestamps count milliseconds
+#define PKT_TRACKER_DK1_SIZE 62
+#define PKT_TRACKER_DK1(F, A, x) \
+	F(x, num_samples, 1, U8) \
+	F(x, timestamp, 2, U16) \
+	F(x, last_command_id, 4, U16) \
+	F(x, temperature, 6, S16) \
+	A(x, samples, 8, IMU, 3, 16) \
+	A(x, mag, 56, S16, 3, 2)
+
+/* Slots past num_samples hold junk (outdated or uninitialised values);
+   decoding them anyway keeps the decoder free of branches */
+#define PKT_TRACKER_DK2_SIZE 64
+#define PKT_TRACKER_DK2(F, A, x) \
+	F(x, last_command_id, 1, U16) \
+	F(x, num_samples, 3, U8) \
+	F(x, sample_count, 4, U16) \
+	F(x, temperature, 6, S16) \
+	F(x, timestamp, 8, U32) \
+	A(x, samples, 12, IMU, 2, 16) \
+	A(x, mag, 44, S16, 3, 2)
+
+/* The vendor driver reads the firmware quaternion where the DK2 layout has
+   its first sample, after the same timestamp. It only takes reads of 16 or
+   32 bytes; of those only the longer has room for this layout, and the 64
+   byte sensor reports carry samples there instead. */
+#define PKT_FW_QUAT_OFFSET 12
+#define PKT_FW_QUAT_SIZE 20
+#define PKT_FW_QUAT_REPORT_SIZE 32
+#define PKT_FW_QUAT(F, A, x) \
+	F(x, timestamp, 8, U32) \
+	A(x, quat, PKT_FW_QUAT_OFFSET, S16, 4, 2)
+
+PKT_LAYOUT(pkt_sensor_range, pkt_sensor_range, PKT_SENSOR_RANGE,
+	   PKT_SENSOR_RANGE_SIZE)
+PKT_LAYOUT(pkt_sensor_config, pkt_sensor_config, PKT_SENSOR_CONFIG,
+	   PKT_SENSOR_CONFIG_SIZE)
+PKT_ENCODER(pkt_sensor_config, pkt_sensor_config, PKT_SENSOR_CONFIG,
+	    RIFT_CMD_SENSOR_CONFIG, PKT_SENSOR_CONFIG_SIZE)
+PKT_LAYOUT(pkt_display_info, pkt_sensor_display_info, PKT_DISPLAY_INFO,
+	   PKT_DISPLAY_INFO_SIZE)
+PKT_ENCODER(pkt_keep_alive, pkt_keep_alive, PKT_KEEP_ALIVE,
+	    RIFT_CMD_KEEP_ALIVE, PKT_KEEP_ALIVE_SIZE)
+PKT_ENCODER(pkt_pimax_keep_alive, pkt_pimax_keep_alive, PKT_PIMAX_KEEP_ALIVE,
+	    PIMAX_CMD_KEEP_ALIVE, PKT_PIMAX_KEEP_ALIVE_SIZE)
+PKT_LAYOUT(pkt_tracker_dk1, pkt_tracker_sensor, PKT_TRACKER_DK1,
+	   PKT_TRACKER_DK1_SIZE)
+PKT_LAYOUT(pkt_tracker_dk2, pkt_tracker_sensor, PKT_TRACKER_DK2,
+	   PKT_TRACKER_DK2_SIZE)
+PKT_LAYOUT(pkt_fw_quat, pkt_fw_quat, PKT_FW_QUAT, PKT_FW_QUAT_SIZE)
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+
+#include "pimaxtrack.h"
+#include "hid.h"
+#include "log.h"
+
+_Static_assert(PIMAXTRACK_LOG_DEBUG == LOG_LEVEL_DEBUG
+	       && PIMAXTRACK_LOG_ERROR == LOG_LEVEL_ERROR,
+	       "log levels go through unchanged");
+
+struct pimaxtrack {
+	HMDHidInfo info;
+	pimaxtrack_callbacks callbacks;
+};
+
+#define POSE_CHUNK 64		// poses pimaxtrack_read_poses() converts at once
+
+static void drop_log(void *user, int level, const char *message)
+{
+	(void)user;
+	(void)level;
+	(void)message;
+}
+
+void pimaxtrack_set_log(void (*fn)(void *user, int level,
+				   const char *message), void *user)
+{
+	log_set_handler(fn ? fn : drop_log, user);
+}
+
+pimaxtrack *pimaxtrack_open(const char *backend, const char *serial)
+{
+	pimaxtrack *t = malloc(sizeof(pimaxtrack));
+
+	if (t && HID_InitDevice(&t->info, backend ? backend : "hidapi",
+				serial)) {
+		free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+pimaxtrack *pimaxtrack_open_replay(const char *path, int fast)
+{
+	pimaxtrack *t = malloc(sizeof(pimaxtrack));
+
+	if (t && HID_InitReplay(&t->info, path,
+				fast ? REPLAY_FAST : REPLAY_REALTIME)) {
+		free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+const char *pimaxtrack_serial(const pimaxtrack * t)
+{
+	return t->info.serial;
+}
+
+static pimaxtrack_vec3 from_vec3f(const vec3f * v)
+{
+	return (pimaxtrack_vec3) { v->x, v->y, v->z };
+}
+
+static void from_pose(const HMDPose * in, pimaxtrack_pose * out)
+{
+	out->orient = (pimaxtrack_quat) { in->orient.x, in->orient.y,
+		in->orient.z, in->orient.w
+	};
+	out->ang_vel = from_vec3f(&in->ang_vel);
+	out->gyro = from_vec3f(&in->gyro);
+	out->accel = from_vec3f(&in->accel);
+	out->timestamp = in->timestamp;
+	out->host_time = in->host_time;
+	out->sample_time = in->sample_time;
+	out->mag_quality = in->mag_quality;
+}
+
+static void sample_callback(void *user, const HMDSample * sample)
+{
+	pimaxtrack *t = user;
+	pimaxtrack_sample out = { sample->timestamp, sample->sample_time,
+		from_vec3f(&sample->accel), from_vec3f(&sample->gyro),
+		from_vec3f(&sample->mag)
+	};
+
+	t->callbacks.sample(t->callbacks.user, &out);
+}
+
+static void pose_callback(void *user, const HMDPose * pose)
+{
+	pimaxtrack *t = user;
+	pimaxtrack_pose out;
+
+	from_pose(pose, &out);
+	t->callbacks.pose(t->callbacks.user, &out);
+}
+
+int pimaxtrack_start(pimaxtrack * t, const pimaxtrack_callbacks * callbacks)
+{
+	if (callbacks) {
+		t->callbacks = *callbacks;
+		HMDCallbacks cb = { callbacks->sample ? sample_callback : NULL,
+			callbacks->pose ? pose_callback : NULL, t
+		};
+		HID_SetCallbacks(&t->info, &cb);
+	}
+
+	return HID_StartReader(&t->info);
+}
+
+int pimaxtrack_running(pimaxtrack * t)
+{
+	return HID_ReaderRunning(&t->info);
+}
+
+double pimaxtrack_now()
+{
+	return HID_get_tick();
+}
+
+int pimaxtrack_get_pose(pimaxtrack * t, pimaxtrack_pose * pose)
+{
+	HMDPose p;
+
+	if (HID_GetLatestPose(&t->info, &p)) {
+		return -1;
+	}
+	from_pose(&p, pose);
+
+	return 0;
+}
+
+int pimaxtrack_get_pose_at(pimaxtrack * t, double time,
+			   pimaxtrack_pose * pose)
+{
+	HMDPose p;
+
+	if (HID_GetPoseAt(&t->info, time, &p)) {
+		return -1;
+	}
+	from_pose(&p, pose);
+
+	return 0;
+}
+
+int pimaxtrack_read_poses(pimaxtrack * t, uint64_t * cursor,
+			  pimaxtrack_pose * out, int max)
+{
+	HMDPose poses[POSE_CHUNK];
+	int n = 0;
+
+	while (n < max) {
+		int want = max - n < POSE_CHUNK ? max - n : POSE_CHUNK;
+		int got = HID_ReadPoses(&t->info, cursor, poses, want);
+		for (int i = 0; i < got; i++) {
+			from_pose(&poses[i], &out[n + i]);
+		}
+		n += got;
+		if (got < want) {
+			break;
+		}
+	}
+
+	return n;
+}
+
+void pimaxtrack_close(pimaxtrack * t)
+{
+	if (!t) {
+		return;
+	}
+
+	HID_Close(&t->info);
+	free(t);
+}
@@ -0,0 +1,102 @@
+/*
+ * libpimaxtrack: Pimax headset tracking inside the process that uses it,
+ * without the hop through the shared memory server. A tracker owns its
+ * device, reader thread and every bit of state, so any number can run side
+ * by side. Poses reach the caller through callbacks on the tracker's
+ * reader thread, by polling the latest one or by draining the queue of
+ * every pose fused.
+ */
+
+#ifndef __PIMAXTRACK__
+#define __PIMAXTRACK__
+
+#include <stdint.h>
+
+// the shared library exports these and nothing else
+#define PIMAXTRACK_API __attribute__((visibility("default")))
+
+typedef struct pimaxtrack pimaxtrack;
+
+typedef struct {
+	float x, y, z;
+} pimaxtrack_vec3;
+
+typedef struct {
+	float x, y, z, w;
+} pimaxtrack_quat;
+
+typedef struct {
+	pimaxtrack_quat orient;
+	pimaxtrack_vec3 ang_vel;	// fused angular velocity in the sensor frame
+	pimaxtrack_vec3 gyro, accel;
+	uint32_t timestamp;	// device timestamp, in us
+	double host_time;	// host time the report arrived at
+	double sample_time;	// host time the last sample was taken at
+	float mag_quality;	// of the magnetometer fit, 0 to 1
+} pimaxtrack_pose;
+
+typedef struct {
+	uint32_t timestamp;	// device timestamp of its report, in us
+	double sample_time;	// host time it was taken at
+	pimaxtrack_vec3 accel, gyro, mag;	// as read, before any calibration
+} pimaxtrack_sample;
+
+/* Called on the tracker's reader thread, so they hold up tracking until
+   they return. Either may be NULL. */
+typedef struct {
+	void (*sample)(void *user, const pimaxtrack_sample * sample);
+	void (*pose)(void *user, const pimaxtrack_pose * pose);
+	void *user;
+} pimaxtrack_callbacks;
+
+/* Levels of the messages handed to a log callback, most verbose first */
+enum {
+	PIMAXTRACK_LOG_DEBUG,
+	PIMAXTRACK_LOG_INFO,
+	PIMAXTRACK_LOG_WARN,
+	PIMAXTRACK_LOG_ERROR
+};
+
+/* Hand the library's messages, one line each without the newline, to fn
+   instead of writing them to stderr; NULL drops them. Called on whichever
+   thread logs, for every tracker; set it before opening any. */
+PIMAXTRACK_API void pimaxtrack_set_log(void (*fn)(void *user, int level,
+						  const char *message),
+				       void *user);
+
+/* Open a headset through backend, "hidapi" when NULL, the one with serial
+   or the first one found when NULL. Returns NULL if there is none. */
+PIMAXTRACK_API pimaxtrack *pimaxtrack_open(const char *backend,
+					   const char *serial);
+/* Play a USBPcap capture or a recording instead, in real time or as fast
+   as it decodes */
+PIMAXTRACK_API pimaxtrack *pimaxtrack_open_replay(const char *path,
+						  int fast);
+
+PIMAXTRACK_API const char *pimaxtrack_serial(const pimaxtrack * t);
+
+/* Start tracking on a thread of its own, handing samples and poses to
+   callbacks if not NULL. Returns -1 if the thread could not start. */
+PIMAXTRACK_API int pimaxtrack_start(pimaxtrack * t,
+				    const pimaxtrack_callbacks * callbacks);
+/* 0 once the device went away or a replay ended */
+PIMAXTRACK_API int pimaxtrack_running(pimaxtrack * t);
+
+/* Host clock all times are on, in seconds */
+PIMAXTRACK_API double pimaxtrack_now();
+
+/* Latest pose, -1 if there is none yet. Lock-free, from any thread. */
+PIMAXTRACK_API int pimaxtrack_get_pose(pimaxtrack * t,
+				       pimaxtrack_pose * pose);
+/* Pose at time t, interpolated or predicted, -1 if t is too old */
+PIMAXTRACK_API int pimaxtrack_get_pose_at(pimaxtrack * t, double time,
+					  pimaxtrack_pose * pose);
+/* Drain the poses fused since *cursor (0 at first), at most max. Returns
+   the number copied. */
+PIMAXTRACK_API int pimaxtrack_read_poses(pimaxtrack * t, uint64_t * cursor,
+					 pimaxtrack_pose * out, int max);
+
+/* Stop tracking, keep what was learnt about the headset and free t */
+PIMAXTRACK_API void pimaxtrack_close(pimaxtrack * t);
+
+#endif
@@ -0,0 +1,36 @@
+/* What tracking hands out: poses, raw IMU samples and the callbacks that
+   receive them. The library hands out copies in the types of pimaxtrack.h,
+   which leave out omath.h. */
+
+#ifndef __HMD_POSE__
+#define __HMD_POSE__
+
+#include <stdint.h>
+
+#include "omath.h"
+
+typedef struct {
+	quatf orient;
+	vec3f ang_vel;		// fused angular velocity in the sensor frame
+	vec3f gyro, accel;
+	uint32_t timestamp;	// device timestamp, in us
+	double host_time;	// host tick the report arrived at
+	double sample_time;	// host tick the last sample was taken at
+	float mag_quality;	// of the magnetometer fit, 0 to 1
+} HMDPose;
+
+typedef struct {
+	uint32_t timestamp;	// device timestamp of its report, in us
+	double sample_time;	// host tick it was taken at
+	vec3f accel, gyro, mag;	// as read, before any calibration
+} HMDSample;
+
+/* Called on the reader thread, so they hold up tracking until they return.
+   Either may be NULL. */
+typedef struct {
+	void (*sample)(void *user, const HMDSample * sample);	// every IMU sample
+	void (*pose)(void *user, const HMDPose * pose);	// every report
+	void *user;
+} HMDCallbacks;
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rec.h"
+#include "log.h"
+
+static uint64_t index_size(uint64_t capacity)
+{
+	uint64_t entries = (capacity + REC_INDEX_INTERVAL - 1) /
+	    REC_INDEX_INTERVAL;
+	uint64_t bytes = entries * sizeof(uint64_t);
+
+	// keep the records page aligned
+	return (bytes + REC_HEADER_SIZE - 1) & ~(uint64_t) (REC_HEADER_SIZE - 1);
+}
+
+static hmd_rec *rec_map(int fd, size_t size, int writable)
+{
+	hmd_rec *rec = calloc(1, sizeof(hmd_rec));
+	if (!rec) {
+		return NULL;
+	}
+
+	rec->fd = fd;
+	rec->writable = writable;
+	rec->map_size = size;
+	rec->map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE :
+			PROT_READ, MAP_SHARED, fd, 0);
+	if (rec->map == MAP_FAILED) {
+		LOGE("rec: mmap failed: %s", strerror(errno));
+		free(rec);
+		return NULL;
+	}
+
+	rec->header = (rec_header *) rec->map;
+	rec->index = (uint64_t *) (rec->map + rec->header->index_offset);
+	rec->records = (rec_record *) (rec->map + rec->header->records_offset);
+
+	return rec;
+}
+
+hmd_rec *rec_create(const char *path, uint64_t capacity)
+{
+	uint64_t index_offset = REC_HEADER_SIZE;
+	uint64_t records_offset = index_offset + index_size(capacity);
+	uint64_t size = records_offset + capacity * sizeof(rec_record);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		LOGE("rec: could not create %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	// real blocks now, rather than SIGBUS on a full disk later
+	int err = posix_fallocate(fd, 0, size);
+	if (err) {
+		LOGE("rec: could not allocate %llu bytes for %s: %s",
+		     (unsigned long long)size, path, strerror(err));
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+
+	rec_header header = { REC_MAGIC, REC_VERSION, sizeof(rec_record),
+		REC_INDEX_INTERVAL, capacity, index_offset, records_offset, 0
+	};
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		LOGE("rec: could not write %s: %s", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+
+	hmd_rec *rec = rec_map(fd, size, 1);
+	if (!rec) {
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+
+	madvise(rec->records, capacity * sizeof(rec_record), MADV_SEQUENTIAL);
+
+	return rec;
+}
+
+int rec_write(hmd_rec * rec, const unsigned char *data, int size,
+	      double host_time)
+{
+	uint64_t n = atomic_load_explicit(&rec->header->count,
+					  memory_order_relaxed);
+
+	if (n >= rec->header->capacity) {
+		if (!rec->full) {
+			LOGW("rec: recording full after %llu reports",
+			     (unsigned long long)n);
+			rec->full = 1;
+		}
+		return -1;
+	}
+
+	rec_record *r = &rec->records[n];
+	r->time_ns = (uint64_t) (host_time * 1e9);
+	r->size = size < REC_REPORT_SIZE ? size : REC_REPORT_SIZE;
+	r->reserved = 0;
+	memcpy(r->data, data, r->size);
+	memset(r->data + r->size, 0, REC_REPORT_SIZE - r->size);
+
+	if (n % REC_INDEX_INTERVAL == 0) {
+		rec->index[n / REC_INDEX_INTERVAL] = r->time_ns;
+	}
+
+	// a reader mapping the file while we record sees complete records
+	atomic_store_explicit(&rec->header->count, n + 1,
+			      memory_order_release);
+
+	return 0;
+}
+
+int rec_check(const unsigned char *map, size_t size)
+{
+	const rec_header *h = (const rec_header *)map;
+
+	if (size < REC_HEADER_SIZE || h->magic != REC_MAGIC) {
+		return -1;
+	}
+	if (h->version != REC_VERSION || h->record_size != sizeof(rec_record)
+	    || h->index_interval != REC_INDEX_INTERVAL) {
+		LOGE("rec: unsupported recording version %u", h->version);
+		return -1;
+	}
+	// the index must fit between the header and the records, with an
+	// entry for every record the recording has room for
+	uint64_t entries = h->capacity / REC_INDEX_INTERVAL +
+	    (h->capacity % REC_INDEX_INTERVAL != 0);
+	if (h->index_offset < REC_HEADER_SIZE
+	    || h->records_offset < h->index_offset
+	    || entries > (h->records_offset - h->index_offset) /
+	    sizeof(uint64_t)) {
+		LOGE("rec: corrupt recording index");
+		return -1;
+	}
+	if (h->records_offset > size || atomic_load(&h->count) > h->capacity
+	    || atomic_load(&h->count) >
+	    (size - h->records_offset) / sizeof(rec_record)) {
+		LOGE("rec: truncated recording");
+		return -1;
+	}
+	// readers copy size bytes out of the record's data
+	const rec_record *records =
+	    (const rec_record *)(map + h->records_offset);
+	for (uint64_t i = 0; i < atomic_load(&h->count); i++) {
+		if (records[i].size == 0 || records[i].size > REC_REPORT_SIZE) {
+			LOGE("rec: record %llu has size %u",
+			     (unsigned long long)i, records[i].size);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+hmd_rec *rec_open(const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		LOGE("rec: could not open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < REC_HEADER_SIZE) {
+		LOGE("rec: %s is not a recording", path);
+		close(fd);
+		return NULL;
+	}
+
+	hmd_rec *rec = rec_map(fd, st.st_size, 0);
+	if (!rec) {
+		close(fd);
+		return NULL;
+	}
+
+	if (rec_check(rec->map, rec->map_size)) {
+		LOGE("rec: %s is not a recording", path);
+		rec_close(rec);
+		return NULL;
+	}
+
+	return rec;
+}
+
+uint64_t rec_count(const hmd_rec * rec)
+{
+	return atomic_load_explicit(&rec->header->count, memory_order_acquire);
+}
+
+const rec_record *rec_get(const hmd_rec * rec, uint64_t i)
+{
+	return i < rec_count(rec) ? &rec->records[i] : NULL;
+}
+
+uint64_t rec_seek(const hmd_rec * rec, double host_time)
+{
+	uint64_t t = host_time <= 0 ? 0 : (uint64_t) (host_time * 1e9);
+	uint64_t count = rec_count(rec);
+	uint64_t lo = 0, hi = (count + REC_INDEX_INTERVAL - 1) /
+	    REC_INDEX_INTERVAL;
+
+	// last index block starting at or before t
+	while (hi - lo > 1) {
+		uint64_t mid = (lo + hi) / 2;
+		if (rec->index[mid] <= t) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	// then the first record in that block at or after t
+	lo *= REC_INDEX_INTERVAL;
+	hi = lo + REC_INDEX_INTERVAL < count ? lo + REC_INDEX_INTERVAL : count;
+	while (lo < hi) {
+		uint64_t mid = (lo + hi) / 2;
+		if (rec->records[mid].time_ns < t) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+void rec_close(hmd_rec * rec)
+{
+	if (rec->writable) {
+		uint64_t used = rec->header->records_offset +
+		    rec_count(rec) * sizeof(rec_record);
+
+		munmap(rec->map, rec->map_size);
+		if (ftruncate(rec->fd, used) < 0) {
+			LOGW("rec: could not trim recording: %s",
+			     strerror(errno));
+		}
+	} else {
+		munmap(rec->map, rec->map_size);
+	}
+	close(rec->fd);
+	free(rec);
+}
@@ -0,0 +1,74 @@
+/*
+ * Compact recordings of raw reports. The file is preallocated and mapped
+ * once, so appending a report is a memcpy with no system call:
+ *
+ *   header | index | records
+ *
+ * Every record holds one report and its CLOCK_MONOTONIC arrival time. The
+ * index holds the time of every REC_INDEX_INTERVAL'th record for seeking.
+ * Closing a recording trims the file to the records actually written.
+ */
+
+#ifndef __HMD_REC__
+#define __HMD_REC__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define REC_MAGIC 0x43455250	// "PREC"
+#define REC_VERSION 1
+#define REC_HEADER_SIZE 4096
+#define REC_REPORT_SIZE 64
+#define REC_INDEX_INTERVAL 1024
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t index_interval;
+	uint64_t capacity;	// records the file has room for
+	uint64_t index_offset;
+	uint64_t records_offset;
+	atomic_ulong count;	// records written so far
+} rec_header;
+
+typedef struct {
+	uint64_t time_ns;	// host CLOCK_MONOTONIC arrival time
+	uint32_t size;
+	uint32_t reserved;
+	unsigned char data[REC_REPORT_SIZE];
+} rec_record;
+
+typedef struct hmd_rec {
+	int fd;
+	int writable;
+	int full;
+	unsigned char *map;
+	size_t map_size;
+	rec_header *header;
+	uint64_t *index;
+	rec_record *records;
+} hmd_rec;
+
+/* Create a recording with room for capacity reports */
+hmd_rec *rec_create(const char *path, uint64_t capacity);
+
+/* Append a report; returns -1 once the recording is full */
+int rec_write(hmd_rec * rec, const unsigned char *data, int size,
+	      double host_time);
+
+hmd_rec *rec_open(const char *path);
+
+/* Check that a mapped file is a recording this code understands */
+int rec_check(const unsigned char *map, size_t size);
+
+uint64_t rec_count(const hmd_rec * rec);
+const rec_record *rec_get(const hmd_rec * rec, uint64_t i);
+
+/* Number of the first record that arrived at or after host_time */
+uint64_t rec_seek(const hmd_rec * rec, double host_time);
+
+void rec_close(hmd_rec * rec);
+
+#endif
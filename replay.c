@@ -0,0 +1,441 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "replay.h"
+#include "backend.h"
+#include "rec.h"
+#include "log.h"
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_SIZE 16
+
+#define LINKTYPE_USBPCAP 249
+
+// USBPcap packet header, see https://desowin.org/usbpcap/captureformat.html
+#define USBPCAP_HEADER_SIZE 27
+#define USBPCAP_INFO_PDO_TO_FDO 0x01
+#define USBPCAP_TRANSFER_INTERRUPT 1
+#define USBPCAP_TRANSFER_CONTROL 2
+#define USBPCAP_CONTROL_STAGE_SETUP 0
+#define USBPCAP_CONTROL_STAGE_COMPLETE 3
+
+// HID class GET_REPORT request (device to host, class, interface)
+#define HID_REQTYPE_GET_REPORT 0xa1
+#define HID_REQ_GET_REPORT 0x01
+
+#define PENDING_SETUPS 16
+
+typedef struct {
+	double time;		// seconds since the first interrupt report
+	const unsigned char *data;
+	int size;
+} replay_packet;
+
+struct hmd_replay {
+	unsigned char *map;
+	size_t map_size;
+	replay_mode mode;
+
+	replay_packet *reports;
+	int num_reports, max_reports;
+	int next_report;
+	double start;		// host tick the first report is due at
+	double report_time;	// host tick the last report became available
+
+	replay_packet *features;
+	int num_features, max_features;
+	int next_feature[256];
+
+	// feature reports written since, answered instead of the capture
+	unsigned char *written[256];
+	int written_size[256];
+};
+
+static uint16_t get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+	return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static double replay_get_tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec * 1.0 + (double)now.tv_nsec / 1000000000.0;
+}
+
+static void sleep_until(double tick)
+{
+	struct timespec ts;
+	ts.tv_sec = (time_t)tick;
+	ts.tv_nsec = (long)((tick - (double)ts.tv_sec) * 1000000000.0);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) ;
+}
+
+static int add_packet(replay_packet ** list, int *num, int *max, double time,
+		      const unsigned char *data, int size)
+{
+	if (*num == *max) {
+		int n = *max ? *max * 2 : 1024;
+		replay_packet *p = realloc(*list, n * sizeof(replay_packet));
+		if (!p) {
+			return -1;
+		}
+		*list = p;
+		*max = n;
+	}
+
+	(*list)[*num].time = time;
+	(*list)[*num].data = data;
+	(*list)[*num].size = size;
+	(*num)++;
+
+	return 0;
+}
+
+static int parse_usbpcap(hmd_replay * replay)
+{
+	const unsigned char *p = replay->map;
+	const unsigned char *end = replay->map + replay->map_size;
+	uint32_t magic = get32(p);
+	double ts_scale = magic == PCAP_MAGIC_NSEC ? 1e-9 : 1e-6;
+	double first = -1.0;
+
+	// irp ids of GET_REPORT requests still waiting for their completion
+	uint64_t pending[PENDING_SETUPS] = { 0 };
+	int pending_pos = 0;
+
+	if (get32(p + 20) != LINKTYPE_USBPCAP) {
+		LOGE("replay: unsupported link type %u", get32(p + 20));
+		return -1;
+	}
+
+	for (p += PCAP_HEADER_SIZE; p + PCAP_RECORD_SIZE <= end;) {
+		double time = get32(p) + get32(p + 4) * ts_scale;
+		uint32_t incl_len = get32(p + 8);
+		const unsigned char *pkt = p + PCAP_RECORD_SIZE;
+
+		p = pkt + incl_len;
+		if (p > end) {
+			LOGE("replay: truncated capture");
+			break;
+		}
+		if (incl_len < USBPCAP_HEADER_SIZE) {
+			continue;
+		}
+
+		uint16_t header_len = get16(pkt);
+		uint64_t irp_id = get64(pkt + 2);
+		uint8_t info = pkt[16];
+		uint8_t endpoint = pkt[21];
+		uint8_t transfer = pkt[22];
+
+		if (header_len < USBPCAP_HEADER_SIZE || header_len > incl_len) {
+			continue;
+		}
+
+		const unsigned char *data = pkt + header_len;
+		int size = incl_len - header_len;
+
+		if (transfer == USBPCAP_TRANSFER_INTERRUPT
+		    && (endpoint & 0x80) && (info & USBPCAP_INFO_PDO_TO_FDO)
+		    && size > 0) {
+			if (first < 0) {
+				first = time;
+			}
+			if (add_packet(&replay->reports, &replay->num_reports,
+				       &replay->max_reports, time - first, data,
+				       size)) {
+				return -1;
+			}
+		} else if (transfer == USBPCAP_TRANSFER_CONTROL
+			   && header_len > USBPCAP_HEADER_SIZE) {
+			uint8_t stage = pkt[USBPCAP_HEADER_SIZE];
+
+			if (stage == USBPCAP_CONTROL_STAGE_SETUP && size >= 8
+			    && data[0] == HID_REQTYPE_GET_REPORT
+			    && data[1] == HID_REQ_GET_REPORT) {
+				pending[pending_pos] = irp_id;
+				pending_pos = (pending_pos + 1) % PENDING_SETUPS;
+			} else if (stage == USBPCAP_CONTROL_STAGE_COMPLETE
+				   && (info & USBPCAP_INFO_PDO_TO_FDO)
+				   && size > 0) {
+				for (int i = 0; i < PENDING_SETUPS; i++) {
+					if (pending[i] != irp_id) {
+						continue;
+					}
+					pending[i] = 0;
+					if (add_packet(&replay->features,
+						       &replay->num_features,
+						       &replay->max_features,
+						       first < 0 ? 0 : time - first,
+						       data, size)) {
+						return -1;
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int parse_recording(hmd_replay * replay)
+{
+	const rec_header *h = (const rec_header *)replay->map;
+	const rec_record *records =
+	    (const rec_record *)(replay->map + h->records_offset);
+	uint64_t count = atomic_load(&h->count);
+
+	for (uint64_t i = 0; i < count; i++) {
+		double time = (records[i].time_ns - records[0].time_ns) * 1e-9;
+		if (add_packet(&replay->reports, &replay->num_reports,
+			       &replay->max_reports, time, records[i].data,
+			       records[i].size)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+hmd_replay *replay_open(const char *path, replay_mode mode)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		LOGE("replay: could not open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < PCAP_HEADER_SIZE) {
+		LOGE("replay: %s is not a capture file", path);
+		close(fd);
+		return NULL;
+	}
+
+	hmd_replay *replay = calloc(1, sizeof(hmd_replay));
+	if (!replay) {
+		close(fd);
+		return NULL;
+	}
+
+	replay->mode = mode;
+	replay->map_size = st.st_size;
+	replay->map = mmap(NULL, replay->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (replay->map == MAP_FAILED) {
+		LOGE("replay: could not map %s: %s", path, strerror(errno));
+		close(fd);
+		free(replay);
+		return NULL;
+	}
+	close(fd);
+
+	uint32_t magic = get32(replay->map);
+	int err;
+
+	if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+		err = parse_usbpcap(replay);
+	} else if (magic == REC_MAGIC) {
+		err = rec_check(replay->map, replay->map_size)
+		    || parse_recording(replay);
+	} else {
+		LOGE("replay: %s: unknown file format", path);
+		err = -1;
+	}
+
+	if (err) {
+		replay_close(replay);
+		return NULL;
+	}
+
+	LOGI("replay: %s: %d reports, %d feature reports", path,
+	     replay->num_reports, replay->num_features);
+
+	return replay;
+}
+
+void replay_close(hmd_replay * replay)
+{
+	if (replay->map && replay->map != MAP_FAILED) {
+		munmap(replay->map, replay->map_size);
+	}
+	for (int i = 0; i < 256; i++) {
+		free(replay->written[i]);
+	}
+	free(replay->reports);
+	free(replay->features);
+	free(replay);
+}
+
+int replay_read(hmd_replay * replay, unsigned char *buf, size_t size,
+		int timeout_ms)
+{
+	if (replay->next_report >= replay->num_reports) {
+		return -1;
+	}
+
+	replay_packet *pkt = &replay->reports[replay->next_report];
+	double now = replay_get_tick();
+
+	replay->report_time = now;
+
+	if (replay->mode == REPLAY_REALTIME) {
+		if (replay->next_report == 0) {
+			replay->start = now;
+		}
+
+		double due = replay->start + pkt->time;
+		if (now < due) {
+			if (timeout_ms == 0) {
+				return 0;
+			}
+			if (timeout_ms > 0 && now + timeout_ms / 1000.0 < due) {
+				sleep_until(now + timeout_ms / 1000.0);
+				return 0;
+			}
+			sleep_until(due);
+		}
+		replay->report_time = due;
+	}
+
+	int len = pkt->size < (int)size ? pkt->size : (int)size;
+	memcpy(buf, pkt->data, len);
+	replay->next_report++;
+
+	return len;
+}
+
+int replay_get_feature_report(hmd_replay * replay, unsigned char *buf,
+			      size_t size)
+{
+	int id = buf[0];
+	int last = -1;
+
+	if (replay->written[id]) {
+		int len = replay->written_size[id] < (int)size ?
+		    replay->written_size[id] : (int)size;
+		memcpy(buf, replay->written[id], len);
+		return len;
+	}
+
+	// hand out the captured responses for this id in order, then keep
+	// repeating the last one like a device returning its current state
+	for (int i = replay->next_feature[id]; i < replay->num_features; i++) {
+		if (replay->features[i].data[0] == id) {
+			last = i;
+			break;
+		}
+	}
+
+	if (last < 0) {
+		for (int i = 0; i < replay->num_features; i++) {
+			if (replay->features[i].data[0] == id) {
+				last = i;
+			}
+		}
+		if (last < 0) {
+			return -1;
+		}
+	} else {
+		replay->next_feature[id] = last + 1;
+	}
+
+	replay_packet *pkt = &replay->features[last];
+	int len = pkt->size < (int)size ? pkt->size : (int)size;
+	memcpy(buf, pkt->data, len);
+
+	return len;
+}
+
+int replay_send_feature_report(hmd_replay * replay, const unsigned char *data,
+			       size_t length)
+{
+	int id = length ? data[0] : 0;
+
+	// a device answers with what it was last told, so keep it
+	if (length) {
+		unsigned char *p = realloc(replay->written[id], length);
+		if (!p) {
+			return -1;
+		}
+		memcpy(p, data, length);
+		replay->written[id] = p;
+		replay->written_size[id] = length;
+	}
+
+	return length;
+}
+
+double replay_report_time(const hmd_replay * replay)
+{
+	return replay->report_time;
+}
+
+int replay_num_reports(const hmd_replay * replay)
+{
+	return replay->num_reports;
+}
+
+int replay_report(const hmd_replay * replay, int i,
+		  const unsigned char **data, double *time)
+{
+	const replay_packet *pkt = &replay->reports[i];
+
+	*data = pkt->data;
+	*time = pkt->time;
+
+	return pkt->size;
+}
+
+static int replay_backend_read(void *dev, unsigned char *buf, size_t size,
+			       int timeout_ms, double *arrival)
+{
+	int res = replay_read(dev, buf, size, timeout_ms);
+	*arrival = replay_report_time(dev);
+	return res;
+}
+
+static int replay_backend_get_feature(void *dev, unsigned char *buf,
+				      size_t size)
+{
+	return replay_get_feature_report(dev, buf, size);
+}
+
+static int replay_backend_send_feature(void *dev, const unsigned char *data,
+				       size_t size)
+{
+	return replay_send_feature_report(dev, data, size);
+}
+
+static void replay_backend_close(void *dev)
+{
+	replay_close(dev);
+}
+
+const hmd_backend backend_replay = {
+	"replay", replay_backend_read, replay_backend_get_feature,
+	replay_backend_send_feature, replay_backend_close
+};
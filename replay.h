@@ -0,0 +1,46 @@
+/* Replay of recorded USB traffic in place of a live headset. Takes USBPcap
+   captures as well as recordings made with rec.h. */
+
+#ifndef __HMD_REPLAY__
+#define __HMD_REPLAY__
+
+#include <stddef.h>
+
+typedef enum {
+	REPLAY_FAST,		// hand out reports as fast as they are read
+	REPLAY_REALTIME		// keep the original inter-report timing
+} replay_mode;
+
+typedef struct hmd_replay hmd_replay;
+
+hmd_replay *replay_open(const char *path, replay_mode mode);
+void replay_close(hmd_replay * replay);
+
+/* Same semantics as hid_read_timeout(): returns the report size, 0 if no
+   report is due within timeout_ms (-1 blocks) and -1 at the end of the
+   capture. */
+int replay_read(hmd_replay * replay, unsigned char *buf, size_t size,
+		int timeout_ms);
+
+/* buf[0] holds the report id on input, like hid_get_feature_report().
+   Reports of an id that was written answer with the last write, like the
+   device would; otherwise the captured responses are handed out in order. */
+int replay_get_feature_report(hmd_replay * replay, unsigned char *buf,
+			      size_t size);
+int replay_send_feature_report(hmd_replay * replay, const unsigned char *data,
+			       size_t length);
+
+/* Host tick at which the last report returned by replay_read() became
+   available: its due time when replaying in real time, otherwise the time
+   it was read. */
+double replay_report_time(const hmd_replay * replay);
+
+int replay_num_reports(const hmd_replay * replay);
+
+/* Report i in place in the mapped file, for tools walking the whole capture
+   without replaying it. Returns its size; *time is seconds since the first
+   report. */
+int replay_report(const hmd_replay * replay, int i,
+		  const unsigned char **data, double *time);
+
+#endif
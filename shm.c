@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm.h"
+#include "log.h"
+
+#define SHM_POLL_NS 1000000	// how often a read-only consumer looks
+
+static long futex(atomic_uint * addr, int op, unsigned val,
+		  const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* The process serving the region under name, 0 if it is gone or the
+   region is not one of ours */
+static pid_t shm_server_pid(const char *name)
+{
+	struct stat st;
+	pid_t pid = 0;
+	int fd = shm_open(name, O_RDONLY, 0);
+
+	if (fd < 0) {
+		return 0;
+	}
+	if (!fstat(fd, &st) && st.st_size == sizeof(hmd_shm_region)) {
+		hmd_shm_region *r = mmap(NULL, sizeof(hmd_shm_region),
+					 PROT_READ, MAP_SHARED, fd, 0);
+		if (r != MAP_FAILED) {
+			pid = r->server_pid;
+			munmap(r, sizeof(hmd_shm_region));
+		}
+	}
+	close(fd);
+
+	return pid > 0 && (!kill(pid, 0) || errno == EPERM) ? pid : 0;
+}
+
+/* Create the region afresh. One a crashed server left behind is unlinked
+   first, never truncated: whoever still maps it keeps a valid mapping. */
+static int shm_create(const char *name)
+{
+	for (int tries = 0; tries < 2; tries++) {
+		int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd >= 0 || errno != EEXIST) {
+			return fd;
+		}
+
+		pid_t pid = shm_server_pid(name);
+		if (pid) {
+			LOGE("shm: %s is served by process %d already", name,
+			     (int)pid);
+			errno = EEXIST;
+			return -1;
+		}
+		LOGW("shm: replacing the stale %s", name);
+		shm_unlink(name);
+	}
+
+	return -1;
+}
+
+static hmd_shm *shm_open_region(const char *name, int owner)
+{
+	hmd_shm *shm = calloc(1, sizeof(hmd_shm));
+	if (!shm) {
+		return NULL;
+	}
+
+	strncpy(shm->name, name ? name : SHM_DEFAULT_NAME,
+		sizeof(shm->name) - 1);
+	shm->owner = owner;
+
+	int fd = owner ? shm_create(shm->name)
+	    : shm_open(shm->name, O_RDWR, 0);
+	shm->writable = fd >= 0;
+	if (!owner && fd < 0 && errno == EACCES) {
+		fd = shm_open(shm->name, O_RDONLY, 0);
+	}
+	if (fd < 0) {
+		// shm_create() said why already
+		if (!owner || errno != EEXIST) {
+			LOGE("shm: could not open %s: %s", shm->name,
+			     strerror(errno));
+		}
+		free(shm);
+		return NULL;
+	}
+
+	if (owner && ftruncate(fd, sizeof(hmd_shm_region)) < 0) {
+		LOGE("shm: could not size %s: %s", shm->name, strerror(errno));
+		close(fd);
+		shm_unlink(shm->name);
+		free(shm);
+		return NULL;
+	}
+
+	shm->region = mmap(NULL, sizeof(hmd_shm_region),
+			   shm->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			   MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shm->region == MAP_FAILED) {
+		LOGE("shm: could not map %s: %s", shm->name, strerror(errno));
+		if (owner) {
+			shm_unlink(shm->name);
+		}
+		free(shm);
+		return NULL;
+	}
+
+	return shm;
+}
+
+hmd_shm *shm_server_open(const char *name)
+{
+	hmd_shm *shm = shm_open_region(name, 1);
+	if (!shm) {
+		return NULL;
+	}
+
+	hmd_shm_region *r = shm->region;
+
+	// ftruncate left everything zero; the header goes last so clients
+	// never see a valid magic on a half set up region, except for the
+	// owner, which a second server checks before anything else
+	r->server_pid = getpid();
+	for (int i = 0; i < SHM_SAMPLES; i++) {
+		atomic_init(&r->samples[i].seq, 0);
+	}
+	r->version = SHM_VERSION;
+	r->size = sizeof(hmd_shm_region);
+	r->num_samples = SHM_SAMPLES;
+	atomic_thread_fence(memory_order_release);
+	r->magic = SHM_MAGIC;
+
+	return shm;
+}
+
+hmd_shm *shm_client_open(const char *name)
+{
+	hmd_shm *shm = shm_open_region(name, 0);
+	if (!shm) {
+		return NULL;
+	}
+
+	hmd_shm_region *r = shm->region;
+	if (r->magic != SHM_MAGIC || r->version != SHM_VERSION
+	    || r->size != sizeof(hmd_shm_region)) {
+		LOGE("shm: %s has an unknown layout (version %u)", shm->name,
+		     r->version);
+		shm_close(shm);
+		return NULL;
+	}
+
+	return shm;
+}
+
+void shm_publish_sample(hmd_shm * shm, uint32_t timestamp, double host_time,
+			const vec3f * accel, const vec3f * gyro,
+			const vec3f * mag)
+{
+	hmd_shm_region *r = shm->region;
+	uint64_t n = atomic_load_explicit(&r->sample_head,
+					  memory_order_relaxed);
+	shm_sample *s = &r->samples[n & (SHM_SAMPLES - 1)];
+
+	atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	s->timestamp = timestamp;
+	s->host_time = host_time;
+	s->accel = *accel;
+	s->gyro = *gyro;
+	s->mag = *mag;
+
+	atomic_store_explicit(&s->seq, n + 1, memory_order_release);
+	atomic_store_explicit(&r->sample_head, n + 1, memory_order_release);
+}
+
+void shm_publish_pose(hmd_shm * shm, const HMDPose * pose)
+{
+	hmd_shm_region *r = shm->region;
+
+	pose_buffer_publish(&r->pose, pose);
+
+	// a consumer counts itself in before it looks at notify, so with both
+	// sequentially consistent either it sees the new value or we see it
+	atomic_fetch_add(&r->notify, 1);
+	if (atomic_load(&r->waiters)) {
+		futex(&r->notify, FUTEX_WAKE, INT_MAX, NULL);
+	}
+}
+
+unsigned shm_client_wait(hmd_shm * shm, unsigned last, int timeout_ms)
+{
+	hmd_shm_region *r = shm->region;
+	unsigned now;
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		tsp = &ts;
+	}
+
+	if (!shm->writable) {
+		struct timespec poll = { 0, SHM_POLL_NS };
+		for (long waited = 0; atomic_load_explicit(&r->notify,
+							   memory_order_acquire)
+		     == last && (timeout_ms < 0 || waited < timeout_ms * 1000000L);
+		     waited += SHM_POLL_NS) {
+			nanosleep(&poll, NULL);
+		}
+
+		return atomic_load_explicit(&r->notify, memory_order_acquire);
+	}
+
+	// FUTEX_WAIT returns at once if the word already moved on
+	atomic_fetch_add(&r->waiters, 1);
+	while ((now = atomic_load(&r->notify)) == last) {
+		if (futex(&r->notify, FUTEX_WAIT, last, tsp) < 0
+		    && errno == ETIMEDOUT) {
+			break;
+		}
+	}
+	atomic_fetch_sub(&r->waiters, 1);
+
+	return atomic_load_explicit(&r->notify, memory_order_acquire);
+}
+
+int shm_client_get_pose(hmd_shm * shm, HMDPose * pose)
+{
+	return pose_buffer_get(&shm->region->pose, pose);
+}
+
+int shm_client_read_samples(hmd_shm * shm, uint64_t * cursor,
+			    shm_sample * out, int max)
+{
+	hmd_shm_region *r = shm->region;
+	uint64_t head = atomic_load_explicit(&r->sample_head,
+					     memory_order_acquire);
+	int n = 0;
+
+	if (head - *cursor > SHM_SAMPLES) {
+		*cursor = head - SHM_SAMPLES;
+	}
+
+	while (*cursor < head && n < max) {
+		shm_sample *s = &r->samples[*cursor & (SHM_SAMPLES - 1)];
+
+		memcpy(&out[n], s, sizeof(shm_sample));
+		atomic_thread_fence(memory_order_acquire);
+
+		// a slot rewritten under us belongs to a newer lap; drop it
+		if (atomic_load_explicit(&s->seq, memory_order_relaxed) ==
+		    *cursor + 1 && atomic_load(&out[n].seq) == *cursor + 1) {
+			n++;
+		}
+		(*cursor)++;
+	}
+
+	return n;
+}
+
+void shm_close(hmd_shm * shm)
+{
+	munmap(shm->region, sizeof(hmd_shm_region));
+	if (shm->owner) {
+		shm_unlink(shm->name);
+	}
+	free(shm);
+}
@@ -0,0 +1,74 @@
+/*
+ * Pose server in shared memory: one process owns the headset and publishes
+ * every pose and raw IMU sample into a versioned region under /dev/shm
+ * that any number of consumers map. The notify word doubles as a futex;
+ * consumers count themselves in waiters around FUTEX_WAIT and the server
+ * only wakes it when that is non-zero. Consumers that may only read the
+ * region poll it instead.
+ */
+
+#ifndef __HMD_SHM__
+#define __HMD_SHM__
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "hid.h"
+
+#define SHM_DEFAULT_NAME "/pimax-tracker"
+#define SHM_MAGIC 0x544d5850	// "PXMT"
+#define SHM_VERSION 5
+#define SHM_SAMPLES 1024	// raw sample ring, power of two
+
+typedef struct {
+	atomic_ulong seq;	// index + 1 once the slot is complete
+	uint32_t timestamp;	// device timestamp, in us
+	double host_time;	// host tick the sample was taken at
+	vec3f accel, gyro, mag;
+} shm_sample;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		// of the whole region
+	uint32_t num_samples;	// capacity of the sample ring
+	int32_t server_pid;	// owner, tells a live server from a stale region
+
+	atomic_uint notify;	// bumped after every report, futex word
+	atomic_uint waiters;	// consumers blocked on notify
+	atomic_ulong sample_head;	// samples ever written
+
+	HMDPoseBuffer pose;
+	shm_sample samples[SHM_SAMPLES];
+} hmd_shm_region;
+
+typedef struct hmd_shm {
+	char name[64];
+	int owner;		// the server unlinks the region on close
+	int writable;		// may count itself in waiters
+	hmd_shm_region *region;
+} hmd_shm;
+
+/* Server side, used by the process owning the device */
+hmd_shm *shm_server_open(const char *name);
+void shm_publish_sample(hmd_shm * shm, uint32_t timestamp, double host_time,
+			const vec3f * accel, const vec3f * gyro,
+			const vec3f * mag);
+void shm_publish_pose(hmd_shm * shm, const HMDPose * pose);
+
+/* Consumer side */
+hmd_shm *shm_client_open(const char *name);
+
+/* Wait up to timeout_ms (-1 forever) for notify to move past last; returns
+   the new value, or last on timeout */
+unsigned shm_client_wait(hmd_shm * shm, unsigned last, int timeout_ms);
+int shm_client_get_pose(hmd_shm * shm, HMDPose * pose);
+
+/* Copy the samples after *cursor into out, at most max; *cursor advances.
+   Returns the number copied, skipping ahead if the writer lapped us. */
+int shm_client_read_samples(hmd_shm * shm, uint64_t * cursor,
+			    shm_sample * out, int max);
+
+void shm_close(hmd_shm * shm);
+
+#endif
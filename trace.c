@@ -0,0 +1,169 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096	// events, power of two
+#define TRACE_IDLE_US 10000	// formatter sleep while the ring is empty
+
+typedef struct {
+	atomic_ulong seq;
+	int id;
+	int nargs;
+	double time;
+	long args[TRACE_MAX_ARGS];
+} trace_slot;
+
+#define TRACE_FORMAT(_id, _fmt) _fmt,
+static const char *trace_formats[] = {
+	TRACE_EVENTS(TRACE_FORMAT)
+};
+#undef TRACE_FORMAT
+
+/*
+ * Bounded multi-producer queue after Dmitry Vyukov: a slot is free for the
+ * producer at position pos when its seq equals pos and holds an event for
+ * the consumer when seq equals pos + 1.
+ */
+static trace_slot ring[TRACE_RING_SIZE];
+static atomic_ulong head, tail;
+static atomic_ulong dropped;
+
+atomic_int trace_enabled;
+
+static pthread_t formatter;
+static atomic_int formatter_running;
+static FILE *trace_out;
+
+static double trace_get_tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec * 1.0 + (double)now.tv_nsec / 1000000000.0;
+}
+
+void trace_record(trace_event id, const long *args, int nargs)
+{
+	unsigned long pos = atomic_load_explicit(&head, memory_order_relaxed);
+	trace_slot *slot;
+
+	for (;;) {
+		slot = &ring[pos & (TRACE_RING_SIZE - 1)];
+		unsigned long seq =
+		    atomic_load_explicit(&slot->seq, memory_order_acquire);
+		long diff = (long)(seq - pos);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit
+			    (&head, &pos, pos + 1, memory_order_relaxed,
+			     memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			atomic_fetch_add_explicit(&dropped, 1,
+						  memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+
+	if (nargs > TRACE_MAX_ARGS) {
+		nargs = TRACE_MAX_ARGS;
+	}
+
+	slot->id = id;
+	slot->nargs = nargs;
+	slot->time = trace_get_tick();
+	memcpy(slot->args, args, nargs * sizeof(long));
+
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+static int trace_drain()
+{
+	int n = 0;
+
+	for (;;) {
+		unsigned long pos =
+		    atomic_load_explicit(&tail, memory_order_relaxed);
+		trace_slot *slot = &ring[pos & (TRACE_RING_SIZE - 1)];
+
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) !=
+		    pos + 1) {
+			break;
+		}
+
+		long a[TRACE_MAX_ARGS] = { 0 };
+		memcpy(a, slot->args, slot->nargs * sizeof(long));
+
+		fprintf(trace_out, "[%.6f] ", slot->time);
+		fprintf(trace_out, trace_formats[slot->id], a[0], a[1], a[2],
+			a[3], a[4], a[5], a[6], a[7], a[8]);
+		fputc('\n', trace_out);
+
+		atomic_store_explicit(&slot->seq, pos + TRACE_RING_SIZE,
+				      memory_order_release);
+		atomic_store_explicit(&tail, pos + 1, memory_order_relaxed);
+		n++;
+	}
+
+	return n;
+}
+
+static void *formatter_thread(void *arg)
+{
+	(void)arg;
+
+	while (atomic_load(&formatter_running)) {
+		if (!trace_drain()) {
+			usleep(TRACE_IDLE_US);
+		}
+	}
+	trace_drain();
+	fflush(trace_out);
+
+	return NULL;
+}
+
+int trace_start(FILE * out)
+{
+	if (atomic_load(&formatter_running)) {
+		return 0;
+	}
+
+	for (int i = 0; i < TRACE_RING_SIZE; i++) {
+		atomic_init(&ring[i].seq, i);
+	}
+	atomic_store(&head, 0);
+	atomic_store(&tail, 0);
+	atomic_store(&dropped, 0);
+
+	trace_out = out;
+	atomic_store(&formatter_running, 1);
+	if (pthread_create(&formatter, NULL, formatter_thread, NULL)) {
+		atomic_store(&formatter_running, 0);
+		return -1;
+	}
+	atomic_store(&trace_enabled, 1);
+
+	return 0;
+}
+
+void trace_stop()
+{
+	if (!atomic_load(&formatter_running)) {
+		return;
+	}
+
+	atomic_store(&trace_enabled, 0);
+	atomic_store(&formatter_running, 0);
+	pthread_join(formatter, NULL);
+}
+
+unsigned long trace_dropped()
+{
+	return atomic_load(&dropped);
+}
@@ -0,0 +1,55 @@
+/*
+ * Binary tracing for the per report hot path. TRACE() stores an event id,
+ * a timestamp and up to TRACE_MAX_ARGS integer arguments in a lock-free
+ * ring; a background thread started by trace_start() formats them later.
+ * While the tracer is stopped TRACE() costs one relaxed load, and building
+ * with -DHMD_NO_TRACE removes it completely. A full ring drops events
+ * rather than blocking.
+ */
+
+#ifndef __HMD_TRACE__
+#define __HMD_TRACE__
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define TRACE_MAX_ARGS 9
+
+// id, format (arguments are longs)
+#define TRACE_EVENTS(X) \
+	X(TRACE_QUAT, "Q: %ld %ld %ld %ld") \
+	X(TRACE_QUAT_RAW, "Q: %ld %ld %ld %ld %ld %ld %ld %ld %ld") \
+	X(TRACE_SENSOR, "timestamp %08lX samples %02lX") \
+	X(TRACE_KEEP_ALIVE, "keep alive sent")
+
+#define TRACE_ENUM(_id, _fmt) _id,
+typedef enum {
+	TRACE_EVENTS(TRACE_ENUM)
+	TRACE_NUM_EVENTS
+} trace_event;
+#undef TRACE_ENUM
+
+extern atomic_int trace_enabled;
+
+void trace_record(trace_event id, const long *args, int nargs);
+
+/* Format events to out from a background thread until trace_stop() */
+int trace_start(FILE * out);
+void trace_stop();
+
+/* Events lost to a full ring since trace_start() */
+unsigned long trace_dropped();
+
+#ifdef HMD_NO_TRACE
+#define TRACE(_id, ...) do { } while (0)
+#else
+#define TRACE(_id, ...) do { \
+	if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) { \
+		long _args[] = { 0, ##__VA_ARGS__ }; \
+		trace_record(_id, _args + 1, \
+			     sizeof(_args) / sizeof(_args[0]) - 1); \
+	} \
+} while (0)
+#endif
+
+#endif